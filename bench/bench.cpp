@@ -0,0 +1,221 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Standalone benchmark of the XenQnt quantizer. Runs the module's process() on one second of audio for every
+ * combination of mapping mode, channel count, kind of scale (equal or random steps), scale size, enabled
+ * density and input signal, and times how long it takes the worker to rebuild the tuning. The results are
+ * printed as CSV:
+ *
+ *     benchmark,mode,channels,scale,steps,density,signal,ns
+ *
+ * where ns is the time per sample (for all channels together) for the quantize rows, and the time per
+ * rebuild for the rebuild rows. Larger scales are timed for the rebuilds only. Pass a number of samples to run more or less than one second per row.
+ */
+
+#include "XenQnt.cpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#define SAMPLE_RATE 48000
+#define NUM_WARMUP_SAMPLES 1000
+#define NUM_REBUILDS 20
+
+enum ScaleKind { EQUAL, RANDOM, NUM_SCALE_KINDS };
+enum Signal { STATIC, STEPPED, LFO, NOISE, NUM_SIGNALS };
+
+static const char *MODE_NAMES[] = { "proximity", "proportional", "12edo" };
+static const char *SCALE_KIND_NAMES[] = { "edo", "random" };
+static const char *SIGNAL_NAMES[] = { "static", "stepped", "lfo", "noise" };
+
+static const int CHANNELS[] = { 1, 2, 4, 8, 16 };
+static const int SCALE_SIZES[] = { 5, 12, 31, 72, 311 };
+// only the rebuilds are timed for these, to show that toggling a step doesn't cost a rebuild of the scale
+static const int LARGE_SCALE_SIZES[] = { 1200, 4096 };
+static const float DENSITIES[] = { 1.f, 0.5f, 0.1f };
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedNs(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+// An equal division of the octave, or an octave with randomly placed steps, with a random selection of
+// (at least one) enabled steps
+static vector<ScaleStep> makeScale(ScaleKind kind, int size, float density, std::mt19937 &rng) {
+    vector<double> cents;
+    std::uniform_real_distribution<double> randomCents(0.0, 1200.0);
+    for (int i = 1; i < size; i++) {
+        cents.push_back(kind == RANDOM ? randomCents(rng) : i * 1200.0 / size);
+    }
+    std::sort(cents.begin(), cents.end());
+    cents.push_back(1200.0);
+    vector<ScaleStep> steps;
+    for (double c : cents) {
+        steps.push_back({ c, false });
+    }
+    vector<int> order;
+    for (int i = 0; i < size; i++) {
+        order.push_back(i);
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+    int numEnabled = std::max(1, (int) round(density * size));
+    for (int i = 0; i < numEnabled; i++) {
+        steps[order[i]].enabled = true;
+    }
+    return steps;
+}
+
+// numSamples frames of PORT_MAX_CHANNELS voltages, every channel with its own take on the signal
+static vector<float> makeSignal(Signal signal, int numSamples, std::mt19937 &rng) {
+    std::uniform_real_distribution<float> volts(MIN_VOLT, MAX_VOLT);
+    vector<float> frames(numSamples * PORT_MAX_CHANNELS);
+    for (int c = 0; c < PORT_MAX_CHANNELS; c++) {
+        float v = volts(rng);
+        float phase = c / (float) PORT_MAX_CHANNELS;
+        for (int i = 0; i < numSamples; i++) {
+            switch (signal) {
+            case STEPPED:
+                // a sequencer at 8 steps per second
+                if (i % (SAMPLE_RATE / 8) == 0) {
+                    v = volts(rng);
+                }
+                break;
+            case LFO:
+                v = 1.f + 4.f * sin(2 * M_PI * (i / (float) SAMPLE_RATE + phase));
+                break;
+            case NOISE:
+                v = volts(rng);
+                break;
+            default:
+                break;
+            }
+            frames[i * PORT_MAX_CHANNELS + c] = v;
+        }
+    }
+    return frames;
+}
+
+// Hand the pending edits to the worker, and the resulting tuning to the module. Returns the time the
+// worker took. The worker thread is stopped, so that it doesn't get in the way of the measurements.
+static double settle(XenQnt *module) {
+    Module::ProcessArgs args = { SAMPLE_RATE, 1.f / SAMPLE_RATE, 0 };
+    module->applyCommands();
+    Clock::time_point start = Clock::now();
+    const TuningSnapshot *snapshot = module->worker.update();
+    double ns = elapsedNs(start);
+    delete module->worker.published.exchange(snapshot);
+    module->process(args);
+    module->worker.freeRetired();
+    return ns;
+}
+
+static double benchRebuildScale(XenQnt *module, const vector<ScaleStep> &scale) {
+    double ns = 0.0;
+    for (int i = 0; i < NUM_REBUILDS; i++) {
+        module->setScale(scale);
+        ns += settle(module);
+    }
+    return ns / NUM_REBUILDS;
+}
+
+static double benchRebuildSteps(XenQnt *module, std::mt19937 &rng) {
+    double ns = 0.0;
+    for (int i = 0; i < NUM_REBUILDS; i++) {
+        TuningEdit edit(TuningEdit::TOGGLE_STEPS, module->tuning->version);
+        edit.addStep(rng() % module->tuning->cents.size());
+        module->worker.send(edit);
+        ns += settle(module);
+    }
+    return ns / NUM_REBUILDS;
+}
+
+static double benchQuantize(XenQnt *module, int numChannels, const vector<float> &frames, int numSamples) {
+    Module::ProcessArgs args = { SAMPLE_RATE, 1.f / SAMPLE_RATE, 0 };
+    Input &input = module->inputs[XenQnt::PITCH_INPUT];
+    input.setChannels(numChannels);
+    module->outputs[XenQnt::PITCH_OUTPUT].setChannels(1);
+    for (int i = 0; i < NUM_WARMUP_SAMPLES; i++) {
+        std::copy(&frames[0], &frames[numChannels], input.voltages);
+        module->process(args);
+    }
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < numSamples; i++) {
+        const float *frame = &frames[i * PORT_MAX_CHANNELS];
+        std::copy(frame, frame + numChannels, input.voltages);
+        module->process(args);
+    }
+    return elapsedNs(start) / numSamples;
+}
+
+int main(int argc, char **argv) {
+    int numSamples = argc > 1 ? atoi(argv[1]) : SAMPLE_RATE;
+    if (numSamples <= 0) {
+        fprintf(stderr, "usage: %s [samples per configuration]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937 rng(1200);
+    vector<float> signals[NUM_SIGNALS];
+    for (int s = 0; s < NUM_SIGNALS; s++) {
+        signals[s] = makeSignal((Signal) s, numSamples, rng);
+    }
+
+    printf("benchmark,mode,channels,scale,steps,density,signal,ns\n");
+    for (int kind = 0; kind < NUM_SCALE_KINDS; kind++) {
+        for (int size : SCALE_SIZES) {
+            for (float density : DENSITIES) {
+                XenQnt *module = new XenQnt();
+                module->worker.stop();
+                // as the engine does when it adds a module
+                module->onSampleRateChange({SAMPLE_RATE, 1.f / SAMPLE_RATE});
+                vector<ScaleStep> scale = makeScale((ScaleKind) kind, size, density, rng);
+                const char *kindName = SCALE_KIND_NAMES[kind];
+
+                printf("rebuild_scale,,,%s,%d,%g,,%.1f\n", kindName, size, density, benchRebuildScale(module, scale));
+                printf("rebuild_steps,,,%s,%d,%g,,%.1f\n", kindName, size, density, benchRebuildSteps(module, rng));
+                // the toggles above may have changed the density
+                module->setScale(scale);
+                settle(module);
+
+                for (int mode = proximity; mode <= twelveEdoInput; mode++) {
+                    module->setInputMappingMode((MappingMode) mode);
+                    for (int numChannels : CHANNELS) {
+                        for (int s = 0; s < NUM_SIGNALS; s++) {
+                            double ns = benchQuantize(module, numChannels, signals[s], numSamples);
+                            printf("quantize,%s,%d,%s,%d,%g,%s,%.1f\n", MODE_NAMES[mode], numChannels, kindName, size,
+                                   density, SIGNAL_NAMES[s], ns);
+                        }
+                    }
+                }
+                fflush(stdout);
+                delete module;
+            }
+        }
+        for (int size : LARGE_SCALE_SIZES) {
+            XenQnt *module = new XenQnt();
+            module->worker.stop();
+            vector<ScaleStep> scale = makeScale((ScaleKind) kind, size, 0.5f, rng);
+            const char *kindName = SCALE_KIND_NAMES[kind];
+            printf("rebuild_scale,,,%s,%d,0.5,,%.1f\n", kindName, size, benchRebuildScale(module, scale));
+            printf("rebuild_steps,,,%s,%d,0.5,,%.1f\n", kindName, size, benchRebuildSteps(module, rng));
+            fflush(stdout);
+            delete module;
+        }
+    }
+    return 0;
+}
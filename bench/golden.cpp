@@ -0,0 +1,271 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Golden regression test of the quantization engine. Replays dense voltage sweeps, and the voltages right
+ * at and around every pitch and decision boundary, through the reference quantizer and through the engine,
+ * for every mapping mode, with and without the enabled mask. Scales come from the .scl files given on the
+ * command line plus a set of generated ones, each with a number of masks, including random ones.
+ *
+ * Every divergence gets printed as a line of CSV:
+ *
+ *     scale,mask,mode,enabled,path,input,expected,expectedIndex,actual,actualIndex
+ *
+ * where path is the scalar mapping function, the block kernel, or the block kernel on a tuning whose
+ * mask was reached by toggling steps. Exits with 1 if there were any.
+ */
+
+#include "quantizer.hpp"
+#include "reference.hpp"
+#include "tuning/Tunings.h"
+#include "tuning/TuningsImpl.h"
+#include <cstdio>
+#include <random>
+#include <string>
+
+#define SWEEP_RESOLUTION 1200 // voltages per volt
+#define SWEEP_RANGE 12.f      // sweep from -SWEEP_RANGE to SWEEP_RANGE
+#define NUM_ULPS 2            // check this many floats on either side of a pitch or boundary
+#define NUM_RANDOM_MASKS 3
+
+static const char *MODE_NAMES[] = { "proximity", "proportional", "12edo" };
+
+static long numChecks = 0;
+static long numDivergences = 0;
+
+struct NamedScale {
+    std::string name;
+    std::vector<ScaleStep> steps;
+};
+
+struct NamedMask {
+    std::string name;
+    std::vector<bool> enabled;
+};
+
+// Load a scale the same way XenQnt does
+static bool loadScale(const char *path, NamedScale &scale) {
+    try {
+        Tunings::Tuning tuning = Tunings::Tuning(Tunings::readSCLFile(path));
+        for (auto tone = tuning.scale.tones.begin(); tone != tuning.scale.tones.end(); tone++) {
+            scale.steps.push_back({ tone->cents, true });
+        }
+    } catch (const Tunings::TuningError &e) {
+        fprintf(stderr, "%s: %s\n", path, e.what());
+        return false;
+    }
+    std::sort(scale.steps.begin(), scale.steps.end(), [](const ScaleStep & left, const ScaleStep & right) {
+        return left.cents < right.cents;
+    });
+    scale.name = path;
+    return true;
+}
+
+static NamedScale makeEdo(int numSteps, double period = 1200.0) {
+    NamedScale scale;
+    scale.name = std::to_string(numSteps) + "-edo";
+    if (period != 1200.0) {
+        scale.name += "-" + std::to_string((int) period);
+    }
+    for (int i = 1; i <= numSteps; i++) {
+        scale.steps.push_back({ i * period / numSteps, true });
+    }
+    return scale;
+}
+
+static NamedScale makeRandomScale(int index, std::mt19937 &rng) {
+    NamedScale scale;
+    scale.name = "random-" + std::to_string(index);
+    int numSteps = 1 + rng() % 40;
+    std::uniform_real_distribution<double> cents(1.0, 2400.0);
+    for (int i = 0; i < numSteps; i++) {
+        scale.steps.push_back({ cents(rng), true });
+    }
+    std::sort(scale.steps.begin(), scale.steps.end(), [](const ScaleStep & left, const ScaleStep & right) {
+        return left.cents < right.cents;
+    });
+    return scale;
+}
+
+static std::vector<NamedMask> makeMasks(int numSteps, std::mt19937 &rng) {
+    std::vector<NamedMask> masks;
+    masks.push_back({ "all", std::vector<bool>(numSteps, true) });
+    masks.push_back({ "none", std::vector<bool>(numSteps, false) });
+    NamedMask single = { "single", std::vector<bool>(numSteps, false) };
+    single.enabled[rng() % numSteps] = true;
+    masks.push_back(single);
+    NamedMask sparse = { "sparse", std::vector<bool>(numSteps, false) };
+    for (int i = 0; i < numSteps; i++) {
+        sparse.enabled[i] = rng() % 10 == 0;
+    }
+    masks.push_back(sparse);
+    for (int m = 0; m < NUM_RANDOM_MASKS; m++) {
+        NamedMask random = { "random-" + std::to_string(m), std::vector<bool>(numSteps, false) };
+        for (int i = 0; i < numSteps; i++) {
+            random.enabled[i] = rng() % 2 == 0;
+        }
+        masks.push_back(random);
+    }
+    return masks;
+}
+
+static void addNeighbours(std::vector<float> &inputs, double v) {
+    float f = v;
+    inputs.push_back(f);
+    float up = f;
+    float down = f;
+    for (int i = 0; i < NUM_ULPS; i++) {
+        up = nextafterf(up, INFINITY);
+        down = nextafterf(down, -INFINITY);
+        inputs.push_back(up);
+        inputs.push_back(down);
+    }
+}
+
+// The voltages to check: a sweep, then every pitch, midpoint, 12-EDO and proportional boundary
+static std::vector<float> makeInputs(const ReferenceQuantizer &reference) {
+    std::vector<float> inputs;
+    for (int i = -SWEEP_RANGE * SWEEP_RESOLUTION; i <= SWEEP_RANGE * SWEEP_RESOLUTION; i++) {
+        inputs.push_back((float) i / SWEEP_RESOLUTION);
+    }
+    const std::vector<TuningStep> *tables[] = { &reference.pitches, &reference.enabledPitches };
+    for (const std::vector<TuningStep> *pitches : tables) {
+        for (size_t i = 0; i < pitches->size(); i++) {
+            addNeighbours(inputs, (*pitches)[i].voltage);
+            if (i > 0) {
+                addNeighbours(inputs, ((*pitches)[i - 1].voltage + (*pitches)[i].voltage) / 2);
+            }
+        }
+    }
+    for (int semitone = -SWEEP_RANGE * 12; semitone <= SWEEP_RANGE * 12; semitone++) {
+        addNeighbours(inputs, (semitone + 0.5) / 12);
+    }
+    double period = reference.scale.back().cents / 1200;
+    int numSteps[] = { (int) reference.scale.size(), reference.numEnabledSteps };
+    for (int n : numSteps) {
+        for (int step = -SWEEP_RANGE / period * n; n > 0 and step <= SWEEP_RANGE / period * n; step++) {
+            addNeighbours(inputs, (step + 0.5) * period / n);
+        }
+    }
+    float specials[] = { 0.f, -0.f, 100.f, -100.f, 1e6f, -1e6f };
+    inputs.insert(inputs.end(), specials, specials + 6);
+    return inputs;
+}
+
+static TuningStep getPitch(Quantizer &quantizer, MappingMode mode, bool enabled, double v) {
+    switch (mode) {
+    case proportional:
+        return enabled ? quantizer.getPitchProportional<true>(v) : quantizer.getPitchProportional<false>(v);
+    case twelveEdoInput:
+        return enabled ? quantizer.getPitchFrom12Edo<true>(v) : quantizer.getPitchFrom12Edo<false>(v);
+    case proximity:
+    default:
+        return enabled ? quantizer.getPitchByProximity<true>(v) : quantizer.getPitchByProximity<false>(v);
+    }
+}
+
+static void check(const std::string &config, const char *path, float input, TuningStep expected, float actual,
+                  int actualIndex) {
+    numChecks++;
+    if ((float) expected.voltage != actual or expected.scaleIndex != actualIndex) {
+        numDivergences++;
+        printf("%s,%s,%.9g,%.9g,%d,%.9g,%d\n", config.c_str(), path, input, (float) expected.voltage,
+               expected.scaleIndex, actual, actualIndex);
+    }
+}
+
+// Quantize the inputs in blocks of 1 to PORT_MAX_CHANNELS channels, so that the decision cells of every
+// channel see all sorts of jumps
+static void checkKernel(const std::string &config, const char *path, const TuningSnapshot &tuning, MappingMode mode,
+                        bool enabled, const std::vector<float> &inputs, const std::vector<TuningStep> &expected) {
+    Quantizer quantizer;
+    quantizer.setTuning(&tuning);
+    Quantizer::Kernel kernel = enabled ? Quantizer::getKernel<true>(mode) : Quantizer::getKernel<false>(mode);
+    float in[PORT_MAX_CHANNELS];
+    float out[PORT_MAX_CHANNELS];
+    int scaleIndices[PORT_MAX_CHANNELS];
+    int numChannels = 1;
+    for (size_t i = 0; i < inputs.size(); i += numChannels) {
+        numChannels = std::min(numChannels % PORT_MAX_CHANNELS + 1, (int) (inputs.size() - i));
+        std::copy(&inputs[i], &inputs[i] + numChannels, in);
+        (quantizer.*kernel)(in, numChannels, out, scaleIndices);
+        for (int c = 0; c < numChannels; c++) {
+            check(config, path, in[c], expected[i + c], out[c], scaleIndices[c]);
+        }
+    }
+}
+
+static void checkScale(const NamedScale &scale, std::mt19937 &rng) {
+    std::vector<NamedMask> masks = makeMasks(scale.steps.size(), rng);
+    for (const NamedMask &mask : masks) {
+        std::vector<ScaleStep> steps = scale.steps;
+        std::vector<ScaleStep> inverse = scale.steps;
+        for (size_t k = 0; k < steps.size(); k++) {
+            steps[k].enabled = mask.enabled[k];
+            inverse[k].enabled = !mask.enabled[k];
+        }
+        ReferenceQuantizer reference(steps);
+        TuningSnapshot tuning = buildTuning(steps);
+        // reach the same mask by toggling every step of the inverse one
+        TuningBuilder builder;
+        builder.setScale(getCents(inverse), StepMask(inverse));
+        builder.setEnabledSteps(StepMask(steps));
+
+        std::vector<float> inputs = makeInputs(reference);
+        Quantizer quantizer;
+        quantizer.setTuning(&tuning);
+        for (int mode = proximity; mode <= twelveEdoInput; mode++) {
+            for (int enabled = 0; enabled <= 1; enabled++) {
+                std::string config = scale.name + "," + mask.name + "," + MODE_NAMES[mode] + "," + std::to_string(enabled);
+                std::vector<TuningStep> expected;
+                for (float input : inputs) {
+                    expected.push_back(reference.getPitch(input, (MappingMode) mode, enabled));
+                    TuningStep actual = getPitch(quantizer, (MappingMode) mode, enabled, input);
+                    check(config, "scalar", input, expected.back(), actual.voltage, actual.scaleIndex);
+                }
+                checkKernel(config, "kernel", tuning, (MappingMode) mode, enabled, inputs, expected);
+                checkKernel(config, "toggled", builder.current, (MappingMode) mode, enabled, inputs, expected);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    std::mt19937 rng(1200);
+    std::vector<NamedScale> scales;
+    for (int i = 1; i < argc; i++) {
+        NamedScale scale;
+        if (!loadScale(argv[i], scale)) {
+            return 1;
+        }
+        scales.push_back(scale);
+    }
+    int edos[] = { 1, 5, 12, 19, 22, 31, 53, 72, 311 };
+    for (int n : edos) {
+        scales.push_back(makeEdo(n));
+    }
+    scales.push_back(makeEdo(13, 1901.955)); // equal-tempered Bohlen-Pierce
+    scales.push_back(makeEdo(9, 702.0));     // a fifth as the period
+    for (int i = 0; i < 6; i++) {
+        scales.push_back(makeRandomScale(i, rng));
+    }
+
+    printf("scale,mask,mode,enabled,path,input,expected,expectedIndex,actual,actualIndex\n");
+    for (const NamedScale &scale : scales) {
+        checkScale(scale, rng);
+    }
+    fprintf(stderr, "%ld checks over %zu scales, %ld divergences\n", numChecks, scales.size(), numDivergences);
+    return numDivergences > 0 ? 1 : 0;
+}
@@ -0,0 +1,233 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+/*
+ * The quantizer as it was before the performance work: a copy of the mapping functions and the tuning
+ * derivation of XenQnt as released in 2.3.0, with the full pitch tables they work on. The golden regression
+ * test holds the engine to this, so don't change it unless the behaviour is meant to change.
+ */
+
+#include "quantizer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <vector>
+
+using namespace std;
+
+#define REFERENCE_MIN_VOLT (-4.f) // the voltage range of 2.3.0, frozen here in case MIN_VOLT or MAX_VOLT change
+#define REFERENCE_MAX_VOLT 6.f
+
+struct ReferenceQuantizer {
+
+    // the vector of all allowed pitches/voltages in the tuning
+    vector<TuningStep> pitches;
+
+    // used by the 12-EDO and proportional mapping algorithms
+    int numNegativeVoltages;
+    int numEnabledNegativeVoltages;
+    int numEnabledSteps;
+
+    // the vector of all enabled pitches/voltages
+    vector<TuningStep> enabledPitches;
+
+    // the tuning in cents
+    vector<ScaleStep> scale;
+
+    ReferenceQuantizer(const vector<ScaleStep> &scale) : scale(scale) {
+        updateTuning();
+    }
+
+    TuningStep getPitch(double v, MappingMode mode, bool enabled) {
+        switch (mode) {
+        case proportional:
+            return getPitchProportional(v, enabled);
+        case twelveEdoInput:
+            return getPitchFrom12Edo(v, enabled);
+        case proximity:
+        default:
+            return getPitchByProximity(v, enabled);
+        }
+    }
+
+    // Proportional mapping: all pitches in the tuning have an inverse image of the same size
+    inline TuningStep getPitchProportional(double v, bool enabled) {
+
+        int pitchIndex;
+        double period = scale.back().cents / 1200;
+        vector<TuningStep> *_pitches;
+
+        if (enabled) {
+            _pitches = &enabledPitches;
+            pitchIndex = numEnabledNegativeVoltages + round(v / period * numEnabledSteps);
+        } else {
+            _pitches = &pitches;
+            pitchIndex = numNegativeVoltages + round(v / period * scale.size());
+        }
+
+        // return 0 V if there are no (enabled) pitches in the tuning
+        if (_pitches->empty()) {
+            int rootIdx = scale.size() - 1;
+            return {0.0, rootIdx};
+        }
+
+        if (pitchIndex < 0) {
+            return _pitches->at(0);
+        }
+
+        if (pitchIndex >= (int) _pitches->size()) {
+            return _pitches->back();
+        }
+
+        return _pitches->at(pitchIndex);
+    }
+
+    // Map consecutive 12-EDO pitches to consecutive pitches in the target tuning, with 0 V <-> 0 V
+    inline TuningStep getPitchFrom12Edo(double v, bool enabled) {
+
+        // return 0 V if there are no (enabled) pitches in the tuning
+        if (pitches.empty()) {
+            int rootIdx = scale.size() - 1;
+            return {0.0, rootIdx};
+        }
+
+        int pitchIndex = numNegativeVoltages + round(v * 12);
+
+        if (pitchIndex < 0) {
+            return pitches.at(0);
+        }
+
+        if (pitchIndex >= (int) pitches.size()) {
+            return pitches.back();
+        }
+
+        TuningStep &step = pitches.at(pitchIndex);
+
+        if (enabled) {
+            return getPitchByProximity(step.voltage, enabled);
+        } else {
+            return step;
+        }
+    }
+
+    // get the nearest allowable pitch
+    inline TuningStep getPitchByProximity(double v, bool enabled) {
+
+        vector<TuningStep> *_pitches = &pitches;
+        if (enabled) {
+            _pitches = &enabledPitches;
+        }
+
+        // return 0 V if there are no (enabled) pitches in the tuning
+        if (_pitches->empty()) {
+            int rootIdx = scale.size() - 1;
+            return {0.0, rootIdx};
+        }
+
+        // compare function for lower_bound
+        auto comp = [](const TuningStep & step, double voltage) {
+            return step.voltage < voltage;
+        };
+
+        auto ceil = lower_bound(_pitches->begin(), _pitches->end(), v, comp);
+        if (ceil == _pitches->begin()) {
+            return *ceil;
+        } else if (ceil == _pitches->end()) {
+            return *(ceil - 1);
+        } else {
+            auto floor = ceil - 1;
+            if ((ceil->voltage - v) > (v - floor->voltage)) {
+                return *floor;
+            } else {
+                return *ceil;
+            }
+        }
+    }
+
+    // Derive the vector of all allowed pitches from the current scale
+    void updateTuning() {
+
+        // Compute positive voltages
+        list<TuningStep> enabledVoltages;
+        list<TuningStep> voltages;
+        double voltage = 0.f;
+        double period = scale.back().cents;
+        // the offset to indicate in which period (e.g. octave for octave-repeating tunings) we are
+        double periodOffset = 0.f;
+        bool done = false;
+        while (!done) {
+            for (auto step = scale.begin(); step != scale.end(); step++) {
+                int index = distance(scale.begin(), step);
+                voltage = periodOffset + step->cents / 1200;
+                if (voltage <= REFERENCE_MAX_VOLT) {
+                    if (step->enabled) {
+                        enabledVoltages.push_back({voltage, index});
+                    }
+                    voltages.push_back({voltage, index});
+                } else {
+                    done = true;
+                    break;
+                }
+            }
+            periodOffset += period / 1200;
+        }
+
+        // Now compute the non-positive voltages
+        voltage = 0.f;
+        periodOffset = 0.f;
+        done = false;
+        int numNonPositiveVoltages = 0;
+        int numEnabledNegativeVoltages = 0;
+        while (!done) {
+            for (auto step = scale.rbegin(); step != scale.rend(); step++) {
+                int index = distance(step, scale.rend()) - 1;
+                voltage = periodOffset + (step->cents - period) / 1200;
+                if (voltage >= REFERENCE_MIN_VOLT) {
+                    if (step->enabled) {
+                        enabledVoltages.push_front({voltage, index});
+                        if (voltage < 0) {
+                            numEnabledNegativeVoltages++;
+                        }
+                    }
+                    voltages.push_front({voltage, index});
+                    numNonPositiveVoltages++;
+                } else {
+                    done = true;
+                    break;
+                }
+            }
+            periodOffset -= period / 1200;
+        }
+
+        // Finally update the tuning
+        numNegativeVoltages = numNonPositiveVoltages - 1;
+        this->numEnabledNegativeVoltages = numEnabledNegativeVoltages;
+        pitches.clear();
+        for (auto v = voltages.begin(); v != voltages.end(); v++) {
+            pitches.push_back(*v);
+        }
+        enabledPitches.clear();
+        for (auto v = enabledVoltages.begin(); v != enabledVoltages.end(); v++) {
+            enabledPitches.push_back(*v);
+        }
+        numEnabledSteps = 0;
+        for (auto step = scale.begin(); step != scale.end(); step++) {
+            if (step->enabled) {
+                numEnabledSteps++;
+            }
+        }
+    }
+};
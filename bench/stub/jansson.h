@@ -0,0 +1,50 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+// Stand-in for the jansson API that XenQnt uses. The benchmark never (de-)serializes, so it's all no-ops.
+
+#include <cstddef>
+#include <cstdio>
+
+struct json_t;
+
+struct json_error_t {
+    char text[160];
+};
+
+#define JSON_INDENT(n) ((n) & 0x1f)
+
+#define json_array_foreach(array, index, value) \
+    for (index = 0; index < json_array_size(array) and (value = json_array_get(array, index)); index++)
+
+json_t *json_object();
+json_t *json_array();
+json_t *json_string(const char *value);
+json_t *json_integer(long long value);
+json_t *json_real(double value);
+json_t *json_boolean(bool value);
+int json_object_set_new(json_t *object, const char *key, json_t *value);
+int json_array_append_new(json_t *array, json_t *value);
+json_t *json_object_get(const json_t *object, const char *key);
+size_t json_array_size(const json_t *array);
+json_t *json_array_get(const json_t *array, size_t index);
+long long json_integer_value(const json_t *integer);
+double json_real_value(const json_t *real);
+bool json_boolean_value(const json_t *boolean);
+const char *json_string_value(const json_t *string);
+int json_dumpf(const json_t *json, FILE *output, size_t flags);
+json_t *json_loadf(FILE *input, size_t flags, json_error_t *error);
+void json_decref(json_t *json);
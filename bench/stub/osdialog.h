@@ -0,0 +1,27 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+// Stand-in for osdialog: the benchmark never opens a file dialog
+
+typedef enum {
+    OSDIALOG_OPEN,
+    OSDIALOG_OPEN_DIR,
+    OSDIALOG_SAVE,
+} osdialog_file_action;
+
+struct osdialog_filters;
+
+char *osdialog_file(osdialog_file_action action, const char *dir, const char *filename, osdialog_filters *filters);
@@ -0,0 +1,520 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+/*
+ * A minimal stand-in for the parts of the Rack SDK that XenQnt uses, so that the quantizer can be built
+ * and benchmarked without Rack. The engine side (ports, params, lights, simd, dsp) behaves like the real
+ * thing; the UI side only needs to compile.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include <emmintrin.h>
+#include <jansson.h>
+
+#define ENUMS(name, count) name, name ## _LAST = name + (count) - 1
+#define PORT_MAX_CHANNELS 16
+#define RACK_GRID_WIDTH 15
+#define RACK_GRID_HEIGHT 380
+#define CHECKMARK(x) ((x) ? "✔" : "")
+#define DEBUG(...) do {} while (0)
+#define INFO(...) do {} while (0)
+#define WARN(...) do {} while (0)
+
+
+namespace rack {
+
+
+namespace simd {
+
+struct int32_4;
+
+// like Rack's float_4, which is a thin wrapper around an SSE register
+struct float_4 {
+    union {
+        __m128 v;
+        float s[4];
+    };
+
+    float_4() {}
+    float_4(__m128 v) : v(v) {}
+    float_4(float x) : v(_mm_set1_ps(x)) {}
+    float_4(float x0, float x1, float x2, float x3) : v(_mm_setr_ps(x0, x1, x2, x3)) {}
+    float_4(int32_4 a); // converts, like Rack's
+
+    static float_4 cast(int32_4 a);
+
+    static float_4 load(const float *x) {
+        return float_4(_mm_loadu_ps(x));
+    }
+
+    void store(float *x) {
+        _mm_storeu_ps(x, v);
+    }
+};
+
+inline float_4 operator+(float_4 a, float_4 b) {
+    return _mm_add_ps(a.v, b.v);
+}
+
+inline float_4 operator-(float_4 a, float_4 b) {
+    return _mm_sub_ps(a.v, b.v);
+}
+
+inline float_4 operator*(float_4 a, float_4 b) {
+    return _mm_mul_ps(a.v, b.v);
+}
+
+inline float_4 operator/(float_4 a, float_4 b) {
+    return _mm_div_ps(a.v, b.v);
+}
+
+inline float_4 operator&(float_4 a, float_4 b) {
+    return _mm_and_ps(a.v, b.v);
+}
+
+inline float_4 operator|(float_4 a, float_4 b) {
+    return _mm_or_ps(a.v, b.v);
+}
+
+inline float_4 operator<(float_4 a, float_4 b) {
+    return _mm_cmplt_ps(a.v, b.v);
+}
+
+inline float_4 operator<=(float_4 a, float_4 b) {
+    return _mm_cmple_ps(a.v, b.v);
+}
+
+inline float_4 operator>(float_4 a, float_4 b) {
+    return _mm_cmpgt_ps(a.v, b.v);
+}
+
+inline float_4 operator>=(float_4 a, float_4 b) {
+    return _mm_cmpge_ps(a.v, b.v);
+}
+
+inline float_4 operator==(float_4 a, float_4 b) {
+    return _mm_cmpeq_ps(a.v, b.v);
+}
+
+inline int movemask(float_4 a) {
+    return _mm_movemask_ps(a.v);
+}
+
+inline float_4 fmin(float_4 a, float_4 b) {
+    return _mm_min_ps(a.v, b.v);
+}
+
+inline float_4 fmax(float_4 a, float_4 b) {
+    return _mm_max_ps(a.v, b.v);
+}
+
+inline float_4 clamp(float_4 x, float_4 a, float_4 b) {
+    return fmin(fmax(x, a), b);
+}
+
+// like Rack's int32_4
+struct int32_4 {
+    union {
+        __m128i v;
+        int32_t s[4];
+    };
+
+    int32_4() {}
+    int32_4(__m128i v) : v(v) {}
+    int32_4(int32_t x) : v(_mm_set1_epi32(x)) {}
+    int32_4(int32_t x0, int32_t x1, int32_t x2, int32_t x3) : v(_mm_setr_epi32(x0, x1, x2, x3)) {}
+    int32_4(float_4 a) : v(_mm_cvttps_epi32(a.v)) {} // truncates, like Rack's
+
+    static int32_4 cast(float_4 a) {
+        return _mm_castps_si128(a.v);
+    }
+};
+
+inline float_4::float_4(int32_4 a) : v(_mm_cvtepi32_ps(a.v)) {}
+
+inline float_4 float_4::cast(int32_4 a) {
+    return _mm_castsi128_ps(a.v);
+}
+
+inline int32_4 operator+(int32_4 a, int32_4 b) {
+    return _mm_add_epi32(a.v, b.v);
+}
+
+inline int32_4 operator-(int32_4 a, int32_4 b) {
+    return _mm_sub_epi32(a.v, b.v);
+}
+
+inline int32_4 operator&(int32_4 a, int32_4 b) {
+    return _mm_and_si128(a.v, b.v);
+}
+
+} // namespace simd
+
+
+namespace dsp {
+
+struct BooleanTrigger {
+    bool state = true;
+
+    bool process(bool state) {
+        bool triggered = state and !this->state;
+        this->state = state;
+        return triggered;
+    }
+};
+
+// lock-free for a single producer and a single consumer, like Rack's
+template <typename T, size_t S>
+struct RingBuffer {
+    std::atomic<size_t> start {0};
+    std::atomic<size_t> end {0};
+    T data[S];
+
+    void push(T t) {
+        size_t i = end % S;
+        data[i] = t;
+        end++;
+    }
+
+    T shift() {
+        size_t i = start % S;
+        T t = data[i];
+        start++;
+        return t;
+    }
+
+    void clear() {
+        start = end.load();
+    }
+
+    bool empty() const {
+        return start == end;
+    }
+
+    bool full() const {
+        return end - start == S;
+    }
+
+    size_t size() const {
+        return end - start;
+    }
+};
+
+} // namespace dsp
+
+
+namespace engine {
+
+struct Param {
+    float value = 0.f;
+
+    float getValue() {
+        return value;
+    }
+
+    void setValue(float value) {
+        this->value = value;
+    }
+};
+
+struct Light {
+    float value = 0.f;
+
+    void setBrightness(float brightness) {
+        value = brightness;
+    }
+
+    float getBrightness() {
+        return value;
+    }
+};
+
+struct Port {
+    float voltages[PORT_MAX_CHANNELS] = {};
+    uint8_t channels = 0;
+
+    float getVoltage(int channel = 0) {
+        return voltages[channel];
+    }
+
+    float *getVoltages(int firstChannel = 0) {
+        return &voltages[firstChannel];
+    }
+
+    void setVoltage(float voltage, int channel = 0) {
+        voltages[channel] = voltage;
+    }
+
+    float getPolyVoltage(int channel) {
+        return voltages[channels == 1 ? 0 : channel];
+    }
+
+    int getChannels() {
+        return channels;
+    }
+
+    void setChannels(int channels) {
+        this->channels = channels;
+    }
+
+    bool isConnected() {
+        return channels > 0;
+    }
+};
+
+struct Input : Port {};
+struct Output : Port {};
+
+struct Module {
+    std::vector<Param> params;
+    std::vector<Input> inputs;
+    std::vector<Output> outputs;
+    std::vector<Light> lights;
+
+    struct ProcessArgs {
+        float sampleRate;
+        float sampleTime;
+        int64_t frame;
+    };
+
+    virtual ~Module() {}
+
+    void config(int numParams, int numInputs, int numOutputs, int numLights) {
+        params.resize(numParams);
+        inputs.resize(numInputs);
+        outputs.resize(numOutputs);
+        lights.resize(numLights);
+    }
+
+    void configInput(int portId, std::string name = "") {}
+    void configOutput(int portId, std::string name = "") {}
+    void configBypass(int inputId, int outputId) {}
+
+    template <typename T = int>
+    void configButton(int paramId, std::string name = "") {}
+
+    virtual void process(const ProcessArgs &args) {}
+    virtual void processBypass(const ProcessArgs &args) {}
+    virtual json_t *dataToJson() {
+        return nullptr;
+    }
+    virtual void dataFromJson(json_t *root) {}
+    virtual void onReset() {}
+    virtual void onRandomize() {}
+    struct SampleRateChangeEvent {
+        float sampleRate;
+        float sampleTime;
+    };
+
+    virtual void onSampleRateChange() {}
+    virtual void onSampleRateChange(const SampleRateChangeEvent &e) {
+        onSampleRateChange();
+    }
+};
+
+} // namespace engine
+
+
+// like rack.hpp, pull the sub-namespaces into rack
+using namespace engine;
+
+
+// Everything below only has to compile
+
+struct Vec {
+    float x = 0.f;
+    float y = 0.f;
+    Vec() {}
+    Vec(float x, float y) : x(x), y(y) {}
+};
+
+inline Vec mm2px(Vec mm) {
+    return mm;
+}
+
+namespace event {
+struct Action {};
+}
+
+namespace plugin {
+struct Model;
+struct Plugin {
+    void addModel(Model *model) {}
+};
+}
+
+using namespace plugin;
+
+namespace window {
+struct Svg {
+    static std::shared_ptr<Svg> load(std::string filename) {
+        return nullptr;
+    }
+};
+}
+
+using namespace window;
+
+namespace system {
+double getTime();
+bool rename(const std::string &srcPath, const std::string &destPath);
+}
+
+namespace string {
+std::string f(const char *format, ...);
+}
+
+namespace asset {
+std::string user(std::string filename);
+std::string plugin(Plugin *plugin, std::string filename);
+}
+
+namespace widget {
+struct Widget {
+    struct DrawArgs {};
+    struct {
+        Vec size;
+    } box;
+    struct ChangeEvent {};
+    virtual ~Widget() {}
+    void addChild(Widget *child) {}
+    void removeChild(Widget *child) {}
+    virtual void onChange(const ChangeEvent &e) {}
+    virtual void step() {}
+    virtual void draw(const DrawArgs &args) {}
+};
+}
+
+using namespace widget;
+
+namespace ui {
+struct Menu : Widget {};
+struct MenuEntry : Widget {};
+struct MenuLabel : MenuEntry {
+    std::string text;
+};
+struct MenuItem : MenuEntry {
+    std::string text;
+    std::string rightText;
+    bool disabled = false;
+    virtual void onAction(const event::Action &e) {}
+    virtual Menu *createChildMenu() {
+        return nullptr;
+    }
+};
+struct MenuSeparator : MenuEntry {};
+struct TextField : Widget {
+    std::string text;
+    std::string placeholder;
+};
+}
+
+using namespace ui;
+
+inline MenuLabel *createMenuLabel(std::string text) {
+    return new MenuLabel;
+}
+
+inline MenuItem *createMenuItem(std::string text, std::string rightText, std::function<void()> action,
+                                bool disabled = false) {
+    return new MenuItem;
+}
+
+inline MenuItem *createSubmenuItem(std::string text, std::string rightText, std::function<void(Menu *)> createMenu,
+                                   bool disabled = false) {
+    return new MenuItem;
+}
+
+namespace app {
+struct ModuleWidget : Widget {
+    Module *module = nullptr;
+    void setModule(Module *module) {
+        this->module = module;
+    }
+    Module *getModule() {
+        return module;
+    }
+    void setPanel(Widget *panel) {}
+    virtual void appendContextMenu(Menu *menu) {}
+    void addInput(Widget *input) {}
+    void addOutput(Widget *output) {}
+    void addParam(Widget *param) {}
+};
+struct ModuleLightWidget : Widget {
+    void addBaseColor(int color) {}
+};
+struct GrayModuleLightWidget : ModuleLightWidget {};
+struct SvgSwitch : Widget {
+    bool momentary = false;
+    void addFrame(std::shared_ptr<Svg> svg) {}
+};
+}
+
+using namespace app;
+
+const int SCHEME_RED = 0;
+const int SCHEME_ORANGE = 1;
+
+struct ScrewSilver : Widget {};
+struct PJ301MPort : Widget {};
+
+template <typename TBase>
+struct SmallLight : TBase {};
+
+inline Widget *createPanel(std::string svgPath) {
+    return new Widget;
+}
+
+template <class TWidget>
+TWidget *createWidget(Vec pos) {
+    return new TWidget;
+}
+
+template <class TWidget>
+TWidget *createInputCentered(Vec pos, Module *module, int inputId) {
+    return new TWidget;
+}
+
+template <class TWidget>
+TWidget *createOutputCentered(Vec pos, Module *module, int outputId) {
+    return new TWidget;
+}
+
+template <class TWidget>
+TWidget *createParamCentered(Vec pos, Module *module, int paramId) {
+    return new TWidget;
+}
+
+template <class TWidget>
+TWidget *createLightCentered(Vec pos, Module *module, int firstLightId) {
+    return new TWidget;
+}
+
+template <class TModule, class TModuleWidget>
+Model *createModel(std::string slug) {
+    return nullptr;
+}
+
+} // namespace rack
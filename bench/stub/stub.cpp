@@ -0,0 +1,127 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#include <rack.hpp>
+#include <osdialog.h>
+
+
+json_t *json_object() {
+    return nullptr;
+}
+
+json_t *json_array() {
+    return nullptr;
+}
+
+json_t *json_string(const char *value) {
+    return nullptr;
+}
+
+json_t *json_integer(long long value) {
+    return nullptr;
+}
+
+json_t *json_real(double value) {
+    return nullptr;
+}
+
+json_t *json_boolean(bool value) {
+    return nullptr;
+}
+
+int json_object_set_new(json_t *object, const char *key, json_t *value) {
+    return -1;
+}
+
+int json_array_append_new(json_t *array, json_t *value) {
+    return -1;
+}
+
+json_t *json_object_get(const json_t *object, const char *key) {
+    return nullptr;
+}
+
+size_t json_array_size(const json_t *array) {
+    return 0;
+}
+
+json_t *json_array_get(const json_t *array, size_t index) {
+    return nullptr;
+}
+
+long long json_integer_value(const json_t *integer) {
+    return 0;
+}
+
+double json_real_value(const json_t *real) {
+    return 0.0;
+}
+
+bool json_boolean_value(const json_t *boolean) {
+    return false;
+}
+
+const char *json_string_value(const json_t *string) {
+    return nullptr;
+}
+
+int json_dumpf(const json_t *json, FILE *output, size_t flags) {
+    return -1;
+}
+
+json_t *json_loadf(FILE *input, size_t flags, json_error_t *error) {
+    return nullptr;
+}
+
+void json_decref(json_t *json) {}
+
+char *osdialog_file(osdialog_file_action action, const char *dir, const char *filename, osdialog_filters *filters) {
+    return nullptr;
+}
+
+
+namespace rack {
+namespace system {
+
+double getTime() {
+    return 0.0;
+}
+
+bool rename(const std::string &srcPath, const std::string &destPath) {
+    return std::rename(srcPath.c_str(), destPath.c_str()) == 0;
+}
+
+} // namespace system
+
+namespace string {
+
+std::string f(const char *format, ...) {
+    return format;
+}
+
+} // namespace string
+
+namespace asset {
+
+// keep the benchmark away from the user's real settings
+std::string user(std::string filename) {
+    return "/nonexistent/" + filename;
+}
+
+std::string plugin(Plugin *plugin, std::string filename) {
+    return filename;
+}
+
+} // namespace asset
+} // namespace rack
@@ -14,38 +14,422 @@
  */
 #include "plugin.hpp"
 #include "utils.hpp"
+#include "rtaudit.hpp"
+#include "quantizer.hpp"
+#include "scalacache.hpp"
+#include "scalalibrary.hpp"
+#include "settings.hpp"
+#include "semaphore.hpp"
 #include <osdialog.h>
-#include "tuning/Tunings.h"
-#include "tuning/TuningsImpl.h"
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 
 using namespace std;
-using namespace Tunings;
 
 #define MATRIX_SIZE 36
 #define TWELVE_EDO "12-EDO"
-#define MAX_HISTORY_SIZE 11 // Note: the context menu will show MAX_HISTORY_SIZE - 1 entries
-#define GLOBAL_SETTINGS_FILENAME "H4N4.json"
+#define SCALA_LIBRARY_FILENAME "H4N4-scala-library.json"
+#define MAX_LIBRARY_RESULTS 50 // the scala library menu shows no more than this, the search narrows it down
+#define BUTTON_RATE 250 // in Hz
+#define NUM_ERROR_BLINKS 4 // of a second each
 
 /*
- * Represents a value in the scala file
+ * A change to the scale or its enabled steps, as sent to the tuning worker
  */
-struct ScaleStep {
-    double cents;
-    bool enabled;
+struct TuningEdit {
+    enum Type {
+        SET_SCALE,
+        TOGGLE_STEPS, // toggle the listed steps
+        SET_STEPS,    // enable the listed steps only
+        SAVE_STEPS,   // back up the enabled steps (when CV gets connected)
+        RESTORE_STEPS,
+        ENABLE_ALL,
+        DISABLE_ALL,
+        RANDOMIZE
+    };
+
+    Type type = SET_SCALE;
+    unsigned version = 0; // the version of the scale the listed steps refer to
+    int numSteps = 0;
+    int steps[PORT_MAX_CHANNELS] = {};
+    vector<ScaleStep> *scale = nullptr; // the new scale, owned by the edit
+
+    TuningEdit() {}
+
+    TuningEdit(Type type, unsigned version, vector<ScaleStep> *scale = nullptr) :
+        type(type), version(version), scale(scale) {}
+
+    void addStep(int scaleIndex) {
+        if (numSteps < PORT_MAX_CHANNELS) {
+            steps[numSteps++] = scaleIndex;
+        }
+    }
+};
+
+/*
+ * Builds the tuning snapshots of a module instance on the background thread of the TuningService. The audio
+ * thread sends all edits through a lock-free queue and picks up the result with an atomic exchange, so it
+ * never waits for (or does) a rebuild. Old snapshots are handed back to the worker to be freed, once the
+ * audio thread has let go of them.
+ */
+struct TuningWorker {
+
+    // the latest snapshot, waiting to be picked up by the audio thread
+    std::atomic<const TuningSnapshot *> published {nullptr};
+
+    // snapshots that the audio thread no longer uses
+    dsp::RingBuffer<const TuningSnapshot *, 16> retired;
+
+    // edits from the audio thread
+    dsp::RingBuffer<TuningEdit, 64> edits;
+
+    std::mutex mutex;
+
+    // The current scale. Only the worker changes it, and only while holding the mutex.
+    vector<double> cents;
+    StepMask enabledSteps;
+    unsigned version = 0;
+    std::atomic<unsigned> numScales {0}; // the number of SET_SCALE edits applied so far
+
+    // backup of the enabled steps so we dont lose them when we connect cv
+    StepMask backupSteps;
+
+    // The tuning as of the last snapshot, which gets updated in place and copied for the next snapshot
+    TuningBuilder builder;
+
+    void start();
+
+    void stop();
+
+    // Called from the service thread
+    void work() {
+        freeRetired();
+        const TuningSnapshot *snapshot = update();
+        if (snapshot) {
+            // a snapshot that was never picked up can go right away
+            delete published.exchange(snapshot);
+        }
+    }
+
+    void freeRetired() {
+        while (!retired.empty()) {
+            delete retired.shift();
+        }
+    }
+
+    // Called from the UI thread
+    vector<ScaleStep> getScale() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return getScaleSteps(cents, enabledSteps);
+    }
+
+    // Called from the audio thread. Returns false if the queue is full, so the edit can be sent again later.
+    bool send(const TuningEdit &edit);
+
+    // Called from the audio thread. Returns nullptr if there is no new snapshot.
+    const TuningSnapshot *take() {
+        // there must be room to retire the current snapshot
+        if (published.load(std::memory_order_relaxed) == nullptr or retired.full()) {
+            return nullptr;
+        }
+        return published.exchange(nullptr);
+    }
+
+    // Called from the audio thread
+    void retire(const TuningSnapshot *snapshot);
+
+    // Apply all pending edits and build a single snapshot of the result (or return nullptr if nothing changed)
+    TuningSnapshot *update() {
+        bool scaleChanged = false;
+        bool stepsChanged = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (!edits.empty()) {
+                TuningEdit edit = edits.shift();
+                if (edit.type == TuningEdit::SET_SCALE) {
+                    scaleChanged |= setScale(*edit.scale);
+                    delete edit.scale;
+                } else {
+                    stepsChanged |= apply(edit);
+                }
+            }
+        }
+        if (scaleChanged) {
+            builder.setScale(cents, enabledSteps);
+        } else if (stepsChanged and (enabledSteps != builder.current.enabledSteps or version != builder.current.version)) {
+            builder.setEnabledSteps(enabledSteps);
+        } else {
+            return nullptr;
+        }
+        builder.current.version = version;
+        return new TuningSnapshot(builder.current);
+    }
+
+    bool setScale(vector<ScaleStep> &steps) {
+        numScales++;
+        // without a positive period the pitches would never leave the voltage range
+        if (steps.empty() or !(steps.back().cents > 0)) {
+            return false;
+        }
+        cents = getCents(steps);
+        enabledSteps = StepMask(steps);
+        backupSteps = enabledSteps;
+        version++;
+        return true;
+    }
+
+    bool apply(const TuningEdit &edit) {
+        switch (edit.type) {
+        case TuningEdit::SET_SCALE:
+            return false;
+        case TuningEdit::TOGGLE_STEPS:
+        case TuningEdit::SET_STEPS:
+            // the steps of an edit based on an older scale may not even exist anymore
+            if (edit.version != version) {
+                return false;
+            }
+            if (edit.type == TuningEdit::SET_STEPS) {
+                enabledSteps.setAll(false);
+            }
+            for (int i = 0; i < edit.numSteps; i++) {
+                if (edit.steps[i] >= 0 and edit.steps[i] < enabledSteps.size()) {
+                    if (edit.type == TuningEdit::SET_STEPS) {
+                        enabledSteps.set(edit.steps[i], true);
+                    } else {
+                        enabledSteps.flip(edit.steps[i]);
+                    }
+                }
+            }
+            return true;
+        case TuningEdit::SAVE_STEPS:
+            backupSteps = enabledSteps;
+            return false;
+        case TuningEdit::RESTORE_STEPS:
+            enabledSteps = backupSteps;
+            return true;
+        case TuningEdit::ENABLE_ALL:
+            enabledSteps.setAll(true);
+            version++;
+            return true;
+        case TuningEdit::DISABLE_ALL:
+            enabledSteps.setAll(false);
+            version++;
+            return true;
+        case TuningEdit::RANDOMIZE:
+            enabledSteps.randomize();
+            version++;
+            return true;
+        }
+        return false;
+    }
+};
+
+
+/*
+ * The background thread that builds the tuning snapshots of all instances of the module, so that a patch
+ * full of them doesn't take a thread each. It sleeps until the audio thread of some instance signals it.
+ * The thread runs only while there are workers: it's started by the first one and stopped (and joined) when
+ * the last one is removed, so never by a static destructor. Rack unloads plugins under a lock that an
+ * exiting thread may need as well (the loader lock on Windows), so a join at unload could deadlock.
+ */
+struct TuningService {
+
+    std::vector<TuningWorker *> workers;
+    std::mutex mutex; // held while the workers do their work
+    bool stopRequested = false;
+    std::thread thread; // runs while there are workers
+
+    // serializes starting and stopping the thread, never taken by the thread itself
+    std::mutex lifecycleMutex;
+
+    Semaphore wakeUp;
+    std::atomic<bool> signalled {false};
+
+    void add(TuningWorker *worker) {
+        std::lock_guard<std::mutex> lifecycleLock(lifecycleMutex);
+        std::lock_guard<std::mutex> lock(mutex);
+        workers.push_back(worker);
+        if (!thread.joinable()) {
+            stopRequested = false;
+            thread = std::thread(&TuningService::run, this);
+        }
+    }
+
+    // Once this returns, the worker is no longer used by the service thread
+    void remove(TuningWorker *worker) {
+        std::lock_guard<std::mutex> lifecycleLock(lifecycleMutex);
+        bool stopping;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            workers.erase(std::remove(workers.begin(), workers.end(), worker), workers.end());
+            stopping = workers.empty() and thread.joinable();
+            stopRequested = stopping;
+        }
+        if (stopping) {
+            wakeUp.post();
+            thread.join();
+        }
+    }
+
+    // Called from the audio thread. Only the first signal since the service woke up posts the semaphore.
+    void signal() {
+        if (!signalled.exchange(true)) {
+            wakeUp.post();
+        }
+    }
+
+    void run() {
+        while (true) {
+            wakeUp.wait();
+            // clear the signal before looking at the workers, so that any later edit signals again
+            signalled = false;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopRequested) {
+                return;
+            }
+            for (auto worker = workers.begin(); worker != workers.end(); worker++) {
+                (*worker)->work();
+            }
+        }
+    }
 };
 
+TuningService tuningService;
+
+// The number of instances of the module. The other background threads of the plugin stop along with the
+// last one as well, rather than at unload (see TuningService).
+static std::atomic<int> numInstances {0};
+
+void TuningWorker::start() {
+    tuningService.add(this);
+    // in case edits arrived before
+    tuningService.signal();
+}
+
+void TuningWorker::stop() {
+    tuningService.remove(this);
+    delete published.exchange(nullptr);
+    freeRetired();
+    while (!edits.empty()) {
+        delete edits.shift().scale;
+    }
+}
+
+bool TuningWorker::send(const TuningEdit &edit) {
+    if (edits.full()) {
+        return false;
+    }
+    edits.push(edit);
+    tuningService.signal();
+    return true;
+}
+
+void TuningWorker::retire(const TuningSnapshot *snapshot) {
+    retired.push(snapshot);
+    tuningService.signal();
+}
+
 /*
- * Represents a step in the actual tuning
+ * Hands the latest value from one thread to another without locking or waiting. The writer and the reader
+ * each own one of three buffers, and swap theirs with the one in the middle.
  */
-struct TuningStep {
-    double voltage;
-    int scaleIndex; // points to corresponding value in the scala file
+template <typename T>
+struct TripleBuffer {
+    T buffers[3];
+    std::atomic<int> middle {1}; // the index of the middle buffer, plus FRESH if it hasn't been read yet
+    int back = 0;
+    int front = 2;
+
+    static const int FRESH = 4;
+
+    // Called from the writer: the buffer to fill in, which is handed over by publish()
+    T &write() {
+        return buffers[back];
+    }
+
+    void publish() {
+        back = middle.exchange(back | FRESH) & ~FRESH;
+    }
+
+    // Called from the reader: the latest value published
+    const T &read() {
+        if (middle.load() & FRESH) {
+            front = middle.exchange(front) & ~FRESH;
+        }
+        return buffers[front];
+    }
+};
+
+/*
+ * What the lights show, as published by process(). The widget derives the brightness of each light from it.
+ */
+struct LightState {
+    uint64_t enabledLights = 0; // bit i is set if the step of light i is enabled
+    int numSteps = 0;
+    int numChannels = 0;
+    int scaleIndices[PORT_MAX_CHANNELS]; // the step each channel of the pitch input is quantized to
+};
+
+/*
+ * A task that process() runs at control rate, every so many samples. Tasks get different phases, so that
+ * their costs are spread over different samples.
+ */
+struct ControlTask {
+    int period = 1; // in samples
+    int countdown = 1;
+
+    // phase is the fraction of the period until the first run
+    void setPeriod(int period, float phase) {
+        this->period = std::max(period, 1);
+        countdown = 1 + (int) (phase * this->period);
+    }
+
+    // Called once per sample. Returns true if the task is due.
+    bool tick() {
+        if (--countdown > 0) {
+            return false;
+        }
+        countdown = period;
+        return true;
+    }
+};
+
+// How often the CV input is checked for changes
+enum CvScanRate {
+    cvScanEverySample,
+    cvScan1Ms,
+    cvScan10Ms
 };
 
+/*
+ * A message from the UI thread to process(), which applies it at the start of the next sample
+ */
+struct Command {
+    enum Type {
+        SET_INPUT_MAPPING_MODE,
+        SET_CV_MAPPING_MODE,
+        SET_CV_SCAN_RATE,
+        EDIT_TUNING // passed on to the tuning worker
+    };
+
+    Type type = EDIT_TUNING;
+    MappingMode mode = proximity;
+    CvScanRate scanRate = cvScan1Ms;
+    TuningEdit::Type editType = TuningEdit::SET_SCALE;
+    vector<ScaleStep> *scale = nullptr; // the new scale for a SET_SCALE edit, owned by the command
 
-enum MappingMode { proximity, proportional, twelveEdoInput };
+    Command() {}
+
+    Command(Type type, MappingMode mode = proximity) : type(type), mode(mode) {}
+
+    Command(CvScanRate scanRate) : type(SET_CV_SCAN_RATE), scanRate(scanRate) {}
+
+    Command(TuningEdit::Type editType, vector<ScaleStep> *scale = nullptr) :
+        type(EDIT_TUNING), editType(editType), scale(scale) {}
+};
 
 
 struct XenQnt : Module {
@@ -70,34 +454,21 @@ struct XenQnt : Module {
         LIGHTS_LEN
     };
 
-    const float MIN_VOLT = -4.f; // ~16 Hz
-    const float MAX_VOLT = 6.f;  // ~17 kHz (if 0 V corresponds with middle C)
-
-    // the vector of all allowed pitches/voltages in the tuning
-    vector<TuningStep> pitches;
-
-    // used by the 12-EDO and proportional mapping algorithms
-    int numNegativeVoltages;
-    int numEnabledNegativeVoltages;
-    int numEnabledSteps;
+    // the tuning used by process(), owned by the audio thread until it gets retired
+    const TuningSnapshot *tuning = nullptr;
 
-    // the vector of all enabled pitches/voltages
-    vector<TuningStep> enabledPitches;
+    // builds the tunings, any changes to the scale go via the worker
+    TuningWorker worker;
 
-    // the tuning in cents
-    vector<ScaleStep> scale;
+    // quantizes the main and CV inputs to the tuning (only the main input uses its decision cells)
+    Quantizer quantizer;
 
-    // any changes to the scale go via this member, which is swapped in inside process() to avoid concurrency issues
-    vector<ScaleStep> newScale;
-
-    // backup tuning so we dont lose it when we connect cv
-    vector<ScaleStep> backupScale;
-
-    // last-seen dir with scala files
+    // last-seen dir with scala files. Set when the tuning menu opens rather than in the constructor, so that
+    // loading a patch doesn't go through the settings once per instance.
     std::string scalaDir;
 
-    // list of last ten scala files
-    list<std::string> history;
+    // the scala file being read in the background, if any (UI thread only)
+    std::shared_ptr<ScalaLoad> scalaLoad;
 
     // the name of the tuning shown in the menu
     std::string tuningName = TWELVE_EDO;
@@ -105,26 +476,52 @@ struct XenQnt : Module {
     // triggers to pick up button pushes
     dsp::BooleanTrigger stepTriggers[MATRIX_SIZE];
 
-    // input one sample ago
-    vector<float> prevInputVolts;
+    // CV input at the last scan and the steps it selected (a negative channel count means it has to be
+    // evaluated again)
+    float prevCvVolts[PORT_MAX_CHANNELS];
+    int prevCvSteps[PORT_MAX_CHANNELS];
+    int prevNumCvChannels = -1;
+    bool cvEditPending = false; // the steps of the last scan have yet to reach the worker
+
+    // the distinct steps (in ascending order) that the CV input enabled at the last edit
+    int cvMaskSteps[PORT_MAX_CHANNELS];
+    int numCvMaskSteps = 0;
+
+    // the scan rate as shown in the menu, and the scan period used by process() (0 for every sample)
+    CvScanRate cvScanRate = cvScan1Ms;
+    float cvScanPeriod = 1e-3f;
 
+    // the mapping modes as shown in the menu (process() only sees the kernels)
     MappingMode cvMappingMode = proximity;
     MappingMode inputMappingMode = proximity;
 
-    bool userPushed = false;
+    // the kernels of the quantizer for the mapping modes, picked when the mode is set
+    Quantizer::Kernel cvKernel = &Quantizer::quantize<proximity, false>;
+    Quantizer::Kernel inputKernel = &Quantizer::quantize<proximity, true>;
 
     bool stepsToggledFromMenu = false;
 
     bool cvConnected = false;
 
-    bool tuningChangeRequested = false;
+    // all changes made from the UI thread go via this queue, so that process() never has to lock anything
+    dsp::RingBuffer<Command, 64> commands;
 
-    float lightUpdateTimer = 0.f;
-    float cvScanTimer = 0.f;
+    // the last scale sent to process(), in case it has yet to arrive at the worker
+    vector<ScaleStep> postedScale;
+    unsigned numPostedScales = 0;
 
-    bool error = false;
-    float blinkTime = 0.f;
-    int blinkCount = 0;
+    // the control rate tasks of process()
+    float sampleRate = 44100.f;
+    ControlTask lightTask;
+    ControlTask buttonTask;
+    ControlTask cvScanTask;
+
+    // the lights for the widget, along with the enabled steps of the current tuning as lights
+    TripleBuffer<LightState> lightStates;
+    uint64_t enabledLights = 0;
+
+    // when the last error in the scala input occurred (UI thread only)
+    double errorTime = -INFINITY;
 
     XenQnt() {
         config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
@@ -138,138 +535,149 @@ struct XenQnt : Module {
             configButton(STEP_PARAMS + i);
         }
 
-        loadHistory();
-
+        setSampleRate(sampleRate);
         onReset();
+        applyCommands();
+        tuning = worker.update();
+        quantizer.setTuning(tuning);
+        updateEnabledLights();
+        worker.start();
+        numInstances++;
     }
 
-    void process(const ProcessArgs &args) override {
-
-        lightUpdateTimer += args.sampleTime;
-        if (lightUpdateTimer > 1.f / FRAME_RATE) {
-            lightUpdateTimer = 0.f;
+    ~XenQnt() {
+        worker.stop();
+        if (--numInstances == 0) {
+            settings.stop();
+            scalaLoader.stop();
+            scalaLibrary.stop();
         }
-        cvScanTimer += args.sampleTime;
-        if (cvScanTimer > 1.f / 1000) {
-            cvScanTimer = 0.f;
+        delete tuning;
+        while (!commands.empty()) {
+            delete commands.shift().scale;
         }
+    }
+
+    void process(const ProcessArgs &args) override {
 
-        // Has there been a change that requires us te recompute the tuning and potentially update the scale
-        if (tuningChangeRequested) {
-            // Has the user changed the scale?
-            if (!newScale.empty()) {
-                scale.assign(newScale.begin(), newScale.end());
-                backupScale = scale;
-                newScale.clear();
+        RT_AUDIT_SCOPE;
+
+        bool lightFrame = lightTask.tick();
+
+        applyCommands();
+
+        // Pick up the latest tuning from the worker, which also frees the old one
+        const TuningSnapshot *snapshot = worker.take();
+        if (snapshot) {
+            // CV input should be re-evaluated if the user has changed the scale
+            if (snapshot->version != tuning->version) {
+                prevNumCvChannels = -1;
             }
-            updateTuning();
-            tuningChangeRequested = false;
-            prevInputVolts.clear(); // CV input should also be re-evaluated
+            worker.retire(tuning);
+            tuning = snapshot;
+            quantizer.setTuning(tuning);
+            updateEnabledLights();
         }
 
-        // Process CV inputs and update the tuning accordingly (scan once per ms)
+        // Process CV inputs and update the tuning accordingly (at the scan rate)
         if (inputs[CV_INPUT].isConnected()) {
-            if (cvScanTimer == 0) {
+            if (cvScanTask.tick()) {
                 // Connection state change
-                if (!cvConnected) {
-                    prevInputVolts.clear();
-                    backupScale = scale;
+                if (!cvConnected and worker.send(TuningEdit(TuningEdit::SAVE_STEPS, tuning->version))) {
+                    prevNumCvChannels = -1;
                     cvConnected = true;
                 }
-                int numChannels = inputs[CV_INPUT].getChannels();
-                vector<float> inputVolts;
-                for (int i = 0; i < numChannels; i++) {
-                    inputVolts.push_back(inputs[CV_INPUT].getVoltage(i));
-                }
-                if (inputVolts != prevInputVolts) {
-                    setEnabledStatusAllSteps(false);
-                    for (auto v = inputVolts.begin(); v != inputVolts.end(); v++) {
-                        TuningStep step = getCvPitch(*v);
-                        scale.at(step.scaleIndex).enabled = true;
-                    }
-                    updateTuning();
-                    prevInputVolts = inputVolts;
+                if (cvConnected) {
+                    scanCv();
                 }
             }
         } else {
             // Connection state change
-            if (cvConnected) {
-                scale = backupScale;
-                updateTuning();
+            if (cvConnected and worker.send(TuningEdit(TuningEdit::RESTORE_STEPS, tuning->version))) {
                 cvConnected = false;
             }
         }
 
-        // Update the red lights
-        if (lightUpdateTimer == 0) {
-            // Blink a few times before we move on if there's an error in the scala input
-            if (error) {
-                dimRedLightsFurtherDown(0);
-                dimOrangeLights();
-                blinkTime += 1.f / FRAME_RATE;
-                if (blinkTime > 1.f) {
-                    blinkCount++;
-                    blinkTime = 0.f;
-                }
-                setRedLight(0, blinkTime > 0.5 ? 0.f : 1.f);
-                if (blinkCount > 3) {
-                    error = false;
-                    blinkCount = 0;
-                    blinkTime = 0.f;
-                }
-            } else {
-                for (auto step = scale.begin(); step != scale.end(); step++) {
-                    int index = scaleToLightIdx(distance(scale.begin(), step));
-                    if (index < MATRIX_SIZE) {
-                        if (step->enabled) {
-                            setRedLight(index, 0.9);
-                        } else {
-                            setRedLight(index, 0.1);
-                        }
-                        if (stepTriggers[index].process(params[STEP_PARAMS + index].getValue())) {
-                            step->enabled = !step->enabled;
-                            userPushed = true;
-                        }
-                    }
-                }
-                // Dim the lights beyond the scale
-                dimRedLightsFurtherDown(scale.size());
-                if (userPushed) {
-                    updateTuning();
-                    userPushed = false;
+        // Poll the buttons
+        if (buttonTask.tick()) {
+            int numSteps = tuning->cents.size();
+            TuningEdit edit(TuningEdit::TOGGLE_STEPS, tuning->version);
+            for (int index = 0; index < MATRIX_SIZE and index < numSteps; index++) {
+                if (stepTriggers[index].process(params[STEP_PARAMS + index].getValue())) {
+                    edit.addStep(lightToScaleIdx(index, numSteps));
                 }
             }
+            if (edit.numSteps > 0) {
+                worker.send(edit);
+            }
         }
 
-        // Process the pitch inputs and set the outputs and the orange lights
+        // Process the pitch inputs (four channels at a time) and set the outputs
         int numChannels = inputs[PITCH_INPUT].getChannels();
+        int scaleIndices[PORT_MAX_CHANNELS];
         if (outputs[PITCH_OUTPUT].isConnected()) {
-            if (lightUpdateTimer == 0 and !error) {
-                dimOrangeLights();
-            }
-            for (int i = 0; i < numChannels; i++) {
-                TuningStep step = getEnabledPitch(inputs[PITCH_INPUT].getVoltage(i));
-                outputs[PITCH_OUTPUT].setVoltage(step.voltage, i);
-                if (lightUpdateTimer == 0 and !error) {
-                    setOrangeLight(scaleToLightIdx(step.scaleIndex), 0.7);
-                }
-            }
+            (quantizer.*inputKernel)(inputs[PITCH_INPUT].getVoltages(), numChannels, outputs[PITCH_OUTPUT].getVoltages(), scaleIndices);
             outputs[PITCH_OUTPUT].setChannels(numChannels);
+        } else {
+            numChannels = 0;
+        }
+
+        // Hand the state of the lights to the widget, which does the rendering
+        if (lightFrame) {
+            LightState &state = lightStates.write();
+            state.enabledLights = enabledLights;
+            state.numSteps = tuning->cents.size();
+            state.numChannels = numChannels;
+            std::copy(scaleIndices, scaleIndices + numChannels, state.scaleIndices);
+            lightStates.publish();
         }
     }
 
+    // Collect the enabled steps that have a light (on a change of the tuning)
+    void updateEnabledLights() {
+        int numSteps = tuning->cents.size();
+        enabledLights = 0;
+        for (int index = 0; index < MATRIX_SIZE and index < numSteps; index++) {
+            if (tuning->enabledSteps.test(lightToScaleIdx(index, numSteps))) {
+                enabledLights |= uint64_t(1) << index;
+            }
+        }
+    }
 
-    void setEnabledStatusAllSteps(bool enabled) {
-        for (auto s = scale.begin(); s != scale.end(); s++) {
-            s->enabled = enabled;
+    // Called from the widget: set the lights according to the latest state published by process()
+    void updateLights() {
+        const LightState &state = lightStates.read();
+        // Blink a few times if there's an error in the scala input
+        double sinceError = system::getTime() - errorTime;
+        if (sinceError < NUM_ERROR_BLINKS) {
+            dimRedLightsFurtherDown(0);
+            dimOrangeLights();
+            setRedLight(0, sinceError - floor(sinceError) > 0.5 ? 0.f : 1.f);
+            return;
+        }
+        for (int i = 0; i < MATRIX_SIZE and i < state.numSteps; i++) {
+            setRedLight(i, (state.enabledLights >> i) & 1 ? 0.9 : 0.1);
+        }
+        // Dim the lights beyond the scale
+        dimRedLightsFurtherDown(state.numSteps);
+        dimOrangeLights();
+        for (int i = 0; i < state.numChannels; i++) {
+            int index = scaleToLightIdx(state.scaleIndices[i], state.numSteps);
+            if (index < MATRIX_SIZE) {
+                setOrangeLight(index, 0.7);
+            }
         }
     }
 
 
     // This weird indexing is necessary because the last value in
     // the scala file corresponds with the first note of the tuning
-    inline int scaleToLightIdx(int scaleIdx) {
-        return (scaleIdx + 1) % scale.size();
+    inline int scaleToLightIdx(int scaleIdx, int numSteps) {
+        return (scaleIdx + 1) % numSteps;
+    }
+
+    inline int lightToScaleIdx(int lightIdx, int numSteps) {
+        return (lightIdx + numSteps - 1) % numSteps;
     }
 
     void setRedLight(int id, float brightness) {
@@ -288,292 +696,189 @@ struct XenQnt : Module {
         this->tuningName = tuningName;
     }
 
-    // update list of used scala files
-    void updateHistory(const char *path) {
-
-        std::string scalaDir = getParentDir(path);
-        setScalaDir(scalaDir);
-
-        // delete item if it already exists
-        auto it = std::find(history.begin(), history.end(), path);
-        if (it != std::end(history)) {
-            history.erase(it);
-        }
-
-        if (history.size() == MAX_HISTORY_SIZE) {
-            history.pop_back();
-        }
-
-        // finally add the new entry at the head
-        history.push_front(path);
+    void setInputMappingMode(MappingMode mode) {
+        inputMappingMode = mode;
+        post(Command(Command::SET_INPUT_MAPPING_MODE, mode));
+    }
 
-        // now write the history to the global JSON file
-        json_t *root = json_object();
-        json_t *jsonHistory = json_array();
-        for (auto entry = history.begin(); entry != history.end(); entry++) {
-            json_array_append_new(jsonHistory, json_string((*entry).c_str()));
-        }
-        json_object_set_new(root, "history", jsonHistory);
-        std::string settingsFilename = asset::user(GLOBAL_SETTINGS_FILENAME);
-        FILE *file = fopen(settingsFilename.c_str(), "w");
-        if (file) {
-            json_dumpf(root, file, JSON_INDENT(3));
-            fclose(file);
-        }
+    void setCvMappingMode(MappingMode mode) {
+        cvMappingMode = mode;
+        post(Command(Command::SET_CV_MAPPING_MODE, mode));
     }
 
-    // read history from JSON file
-    void loadHistory() {
+    void setCvScanRate(CvScanRate rate) {
+        cvScanRate = rate;
+        post(Command(rate));
+    }
 
-        std::string settingsFilename = asset::user(GLOBAL_SETTINGS_FILENAME);
-        FILE *file = fopen(settingsFilename.c_str(), "r");
+    void editTuning(TuningEdit::Type type) {
+        post(Command(type));
+    }
 
-        if (!file) {
-            return;
+    void setScale(const vector<ScaleStep> &steps) {
+        if (post(Command(TuningEdit::SET_SCALE, new vector<ScaleStep>(steps)))) {
+            postedScale = steps;
+            numPostedScales++;
         }
+    }
 
-        json_error_t error;
-        json_t *root = json_loadf(file, 0, &error);
-        fclose(file);
-
-        json_t *jsonHistory = json_object_get(root, "history");
-
-        if (jsonHistory) {
-            history.clear();
-            size_t i;
-            json_t *val;
-            json_array_foreach(jsonHistory, i, val) {
-                history.push_back(json_string_value(val));
-            }
-            if (!history.empty()) {
-                setScalaDir(getParentDir(history.front().c_str()));
-            }
+    // The current scale, as seen from the UI thread
+    vector<ScaleStep> getScale() {
+        if (worker.numScales < numPostedScales) {
+            return postedScale;
         }
+        return worker.getScale();
     }
 
-
-    inline TuningStep getEnabledPitch(double v) {
-        switch (inputMappingMode) {
-        case proportional:
-            return getPitchProportional(v, true);
-        case proximity:
-            return getPitchByProximity(v, true);
-        case twelveEdoInput:
-            return getPitchFrom12Edo(v, true);
-        default:
-            return getPitchByProximity(v, true);
+    // Called from the UI thread. Returns false if the queue is full, which only happens when process()
+    // isn't running (the bypass is processed as well).
+    bool post(const Command &command) {
+        if (commands.full()) {
+            delete command.scale;
+            return false;
         }
+        commands.push(command);
+        return true;
     }
 
-    inline TuningStep getCvPitch(double v) {
-        switch (cvMappingMode) {
-        case proportional:
-            return getPitchProportional(v, false);
-        case proximity:
-            return getPitchByProximity(v, false);
-        case twelveEdoInput:
-            return getPitchFrom12Edo(v, false);
-        default:
-            return getPitchByProximity(v, false);
+    // Apply the commands from the UI thread. Edits of the tuning all end up in the same rebuild.
+    void applyCommands() {
+        while (!commands.empty()) {
+            // make sure the worker has room for any edit before taking the command
+            if (worker.edits.full()) {
+                return;
+            }
+            Command command = commands.shift();
+            switch (command.type) {
+            case Command::SET_INPUT_MAPPING_MODE:
+                inputKernel = Quantizer::getKernel<true>(command.mode);
+                quantizer.cells.invalidate();
+                break;
+            case Command::SET_CV_MAPPING_MODE:
+                cvKernel = Quantizer::getKernel<false>(command.mode);
+                prevNumCvChannels = -1; // CV input should be re-evaluated
+                break;
+            case Command::SET_CV_SCAN_RATE:
+                cvScanPeriod = command.scanRate == cvScan10Ms ? 10e-3f : command.scanRate == cvScan1Ms ? 1e-3f : 0.f;
+                cvScanTask.setPeriod(std::round(cvScanPeriod * sampleRate), 0.f); // the next scan is right away
+                break;
+            case Command::EDIT_TUNING:
+                worker.send(TuningEdit(command.editType, 0, command.scale));
+                break;
+            }
         }
     }
 
-    // Proportional mapping: all pitches in the tuning have an inverse image of the same size
-    inline TuningStep getPitchProportional(double v, bool enabled) {
-
-        int pitchIndex;
-        double period = scale.back().cents / 1200;
-        vector<TuningStep> *_pitches;
-
-        if (enabled) {
-            _pitches = &enabledPitches;
-            pitchIndex = numEnabledNegativeVoltages + round(v / period * numEnabledSteps);
+    // Requantize the CV channels that have changed since the last scan. Only a change in the number of
+    // channels (or of the tuning) requantizes all of them. The worker only gets an edit if the set of
+    // steps the channels select has changed, so jitter on the CV input doesn't cause any rebuilds.
+    void scanCv() {
+        int numChannels = inputs[CV_INPUT].getChannels();
+        const float *inputVolts = inputs[CV_INPUT].getVoltages();
+        float volts[PORT_MAX_CHANNELS];
+        // after a change of the tuning (or the connection) the steps have to be sent regardless
+        bool force = cvEditPending or prevNumCvChannels < 0;
+        bool changed = false;
+        if (numChannels != prevNumCvChannels) {
+            (quantizer.*cvKernel)(inputVolts, numChannels, volts, prevCvSteps);
+            std::copy(inputVolts, inputVolts + numChannels, prevCvVolts);
+            prevNumCvChannels = numChannels;
+            changed = true;
         } else {
-            _pitches = &pitches;
-            pitchIndex = numNegativeVoltages + round(v / period * scale.size());
+            for (int c = 0; c < numChannels; c++) {
+                if (inputVolts[c] != prevCvVolts[c]) {
+                    (quantizer.*cvKernel)(inputVolts + c, 1, volts, prevCvSteps + c);
+                    prevCvVolts[c] = inputVolts[c];
+                    changed = true;
+                }
+            }
         }
-
-        // return 0 V if there are no (enabled) pitches in the tuning
-        if (_pitches->empty()) {
-            int rootIdx = scale.size() - 1;
-            return {0.0, rootIdx};
+        if (!changed and !force) {
+            return;
         }
-
-        if (pitchIndex < 0) {
-            return _pitches->at(0);
+        int maskSteps[PORT_MAX_CHANNELS];
+        std::copy(prevCvSteps, prevCvSteps + numChannels, maskSteps);
+        std::sort(maskSteps, maskSteps + numChannels);
+        int numMaskSteps = std::unique(maskSteps, maskSteps + numChannels) - maskSteps;
+        if (!force and numMaskSteps == numCvMaskSteps and std::equal(maskSteps, maskSteps + numMaskSteps, cvMaskSteps)) {
+            return;
         }
-
-        if (pitchIndex >= _pitches->size()) {
-            return _pitches->back();
+        std::copy(maskSteps, maskSteps + numMaskSteps, cvMaskSteps);
+        numCvMaskSteps = numMaskSteps;
+        TuningEdit edit(TuningEdit::SET_STEPS, tuning->version);
+        for (int i = 0; i < numMaskSteps; i++) {
+            edit.addStep(maskSteps[i]);
         }
-
-        return _pitches->at(pitchIndex);
+        // if the worker is busy, the steps are sent again at the next scan
+        cvEditPending = !worker.send(edit);
     }
 
-    // Map consecutive 12-EDO pitches to consecutive pitches in the target tuning, with 0 V <-> 0 V
-    inline TuningStep getPitchFrom12Edo(double v, bool enabled) {
-
-        // return 0 V if there are no (enabled) pitches in the tuning
-        if (pitches.empty()) {
-            int rootIdx = scale.size() - 1;
-            return {0.0, rootIdx};
-        }
+    void onSampleRateChange(const SampleRateChangeEvent &e) override {
+        setSampleRate(e.sampleRate);
+    }
 
-        int pitchIndex = numNegativeVoltages + round(v * 12);
+    // Derive the periods of the control rate tasks, with the lights, buttons and CV scans a third of a
+    // period apart
+    void setSampleRate(float sampleRate) {
+        this->sampleRate = sampleRate;
+        lightTask.setPeriod(std::round(sampleRate / FRAME_RATE), 0.f);
+        buttonTask.setPeriod(std::round(sampleRate / BUTTON_RATE), 1.f / 3);
+        cvScanTask.setPeriod(std::round(cvScanPeriod * sampleRate), 2.f / 3);
+    }
 
-        if (pitchIndex < 0) {
-            return pitches.at(0);
-        }
+    void processBypass(const ProcessArgs &args) override {
+        applyCommands();
+        Module::processBypass(args);
+    }
 
-        if (pitchIndex >= pitches.size()) {
-            return pitches.back();
-        }
+    // update list of used scala files
+    void updateHistory(const char *path) {
 
-        TuningStep &step = pitches.at(pitchIndex);
+        std::string scalaDir = getParentDir(path);
+        setScalaDir(scalaDir);
 
-        if (enabled) {
-            return getPitchByProximity(step.voltage, enabled);
-        } else {
-            return step;
-        }
+        // the shared settings write the history to the global JSON file in the background
+        settings.addToHistory(path);
     }
 
-    // get the nearest allowable pitch
-    inline TuningStep getPitchByProximity(double v, bool enabled) {
+    // get the history shared by all instances, which is only read again if the global JSON file has changed
+    list<std::string> loadHistory() {
 
-        vector<TuningStep> *_pitches = &pitches;
-        if (enabled) {
-            _pitches = &enabledPitches;
+        list<std::string> history = settings.getHistory();
+        if (!history.empty()) {
+            setScalaDir(getParentDir(history.front().c_str()));
         }
-
-        // return 0 V if there are no (enabled) pitches in the tuning
-        if (_pitches->empty()) {
-            int rootIdx = scale.size() - 1;
-            return {0.0, rootIdx};
-        }
-
-        // compare function for lower_bound
-        auto comp = [](const TuningStep & step, double voltage) {
-            return step.voltage < voltage;
-        };
-
-        auto ceil = lower_bound(_pitches->begin(), _pitches->end(), v, comp);
-        if (ceil == _pitches->begin()) {
-            return *ceil;
-        } else if (ceil == _pitches->end()) {
-            return *(ceil - 1);
-        } else {
-            auto floor = ceil - 1;
-            if ((ceil->voltage - v) > (v - floor->voltage)) {
-                return *floor;
-            } else {
-                return *ceil;
-            }
+        // read the other recent tunings ahead, so that switching to them is instant
+        for (auto entry = history.begin(); entry != history.end(); entry++) {
+            scalaLoader.prefetch(*entry);
         }
+        return history;
     }
 
 
+    // Start reading a scala file in the background. The widget picks up the result (see applyLoadedScale).
     void updateScale(const char *scalaFile) {
-
-        newScale.clear();
-
-        // update the tuning name (i.e. the basename of the scala file)
-        std::string oldTuningName = tuningName;
-        tuningName = getBaseName(scalaFile);
-
-        // compare function for sort
-        auto comp = [](const ScaleStep & stepLeft, const ScaleStep & stepRight) {
-            return stepLeft.cents < stepRight.cents;
-        };
-        try {
-            Tuning tuning = Tuning(readSCLFile(scalaFile));
-            vector<Tone> tones = tuning.scale.tones;
-            // first put all cent values in a list
-            for (auto tone = tones.begin(); tone != tones.end(); tone++) {
-                newScale.push_back({(*tone).cents, true});
-            }
-            // sort the scale, because the Scala spec allows for unsorted scale steps
-            sort(newScale.begin(), newScale.end(), comp);
-        } catch (const TuningError &e) {
-            tuningName = oldTuningName;
-            error = true;
-            return;
-        }
+        scalaLoad = scalaLoader.load(scalaFile);
     }
 
-
-    // Derive the vector of all allowed pitches from the current scale
-    void updateTuning() {
-
-        // Compute positive voltages
-        list<TuningStep> enabledVoltages;
-        list<TuningStep> voltages;
-        double voltage = 0.f;
-        double period = scale.back().cents;
-        // the offset to indicate in which period (e.g. octave for octave-repeating tunings) we are
-        double periodOffset = 0.f;
-        bool done = false;
-        while (!done) {
-            for (auto step = scale.begin(); step != scale.end(); step++) {
-                int index = distance(scale.begin(), step);
-                voltage = periodOffset + step->cents / 1200;
-                if (voltage <= MAX_VOLT) {
-                    if (step->enabled) {
-                        enabledVoltages.push_back({voltage, index});
-                    }
-                    voltages.push_back({voltage, index});
-                } else {
-                    done = true;
-                    break;
-                }
-            }
-            periodOffset += period / 1200;
-        }
-
-        // Now compute the non-positive voltages
-        voltage = 0.f;
-        periodOffset = 0.f;
-        done = false;
-        int numNonPositiveVoltages = 0;
-        int numEnabledNegativeVoltages = 0;
-        while (!done) {
-            for (auto step = scale.rbegin(); step != scale.rend(); step++) {
-                int index = distance(step, scale.rend()) - 1;
-                voltage = periodOffset + (step->cents - period) / 1200;
-                if (voltage >= MIN_VOLT) {
-                    if (step->enabled) {
-                        enabledVoltages.push_front({voltage, index});
-                        if (voltage < 0) {
-                            numEnabledNegativeVoltages++;
-                        }
-                    }
-                    voltages.push_front({voltage, index});
-                    numNonPositiveVoltages++;
-                } else {
-                    done = true;
-                    break;
-                }
-            }
-            periodOffset -= period / 1200;
-        }
-
-        // Finally update the tuning
-        numNegativeVoltages = numNonPositiveVoltages - 1;
-        this->numEnabledNegativeVoltages = numEnabledNegativeVoltages;
-        pitches.clear();
-        for (auto v = voltages.begin(); v != voltages.end(); v++) {
-            pitches.push_back(*v);
+    // Called from the widget: switch to the scale of the scala file, once it's been read
+    void applyLoadedScale() {
+        if (!scalaLoad or !scalaLoad->done) {
+            return;
         }
-        enabledPitches.clear();
-        for (auto v = enabledVoltages.begin(); v != enabledVoltages.end(); v++) {
-            enabledPitches.push_back(*v);
+        std::shared_ptr<ScalaLoad> load;
+        load.swap(scalaLoad);
+        if (load->failed) {
+            errorTime = system::getTime();
+            return;
         }
-        numEnabledSteps = 0;
-        for (auto step = scale.begin(); step != scale.end(); step++) {
-            if (step->enabled) {
-                numEnabledSteps++;
-            }
+        // update the tuning name (i.e. the basename of the scala file)
+        tuningName = getBaseName(load->path.c_str());
+        vector<ScaleStep> steps;
+        for (auto c = load->cents.begin(); c != load->cents.end(); c++) {
+            steps.push_back({*c, true});
         }
+        setScale(steps);
     }
 
     // dim red lights beyond the offset
@@ -592,24 +897,16 @@ struct XenQnt : Module {
     // set 12 equal as initial tuning
     void onReset() override {
         tuningName = TWELVE_EDO;
-        newScale.clear();
+        vector<ScaleStep> steps;
         for (int i = 1; i <= 12; i++) {
-            newScale.push_back({ i * 100.f, true });
+            steps.push_back({ i * 100.f, true });
         }
-        tuningChangeRequested = true;
+        setScale(steps);
     }
 
     // enable random notes in the selected tuning
     void onRandomize() override {
-        for (auto step = scale.begin(); step != scale.end(); step++) {
-            int coin = rand() % 100;
-            if (coin >= 50) {
-                step->enabled = true;
-            } else {
-                step->enabled = false;
-            }
-        }
-        tuningChangeRequested = true;
+        editTuning(TuningEdit::RANDOMIZE);
     }
 
     // VCV (de-)serialization callbacks
@@ -619,6 +916,8 @@ struct XenQnt : Module {
         json_t *jsonTuningName = json_string(tuningName.c_str());
         json_t *jsonInputMappingMode = json_integer(inputMappingMode);
         json_t *jsonCvMappingMode = json_integer(cvMappingMode);
+        json_t *jsonCvScanRate = json_integer(cvScanRate);
+        vector<ScaleStep> scale = getScale();
         for (auto v = scale.begin(); v != scale.end(); v++) {
             json_t *step = json_object();
             json_t *cents = json_real(v->cents);
@@ -629,6 +928,7 @@ struct XenQnt : Module {
         }
         json_object_set_new(root, "inputMappingMode", jsonInputMappingMode);
         json_object_set_new(root, "cvMappingMode", jsonCvMappingMode);
+        json_object_set_new(root, "cvScanRate", jsonCvScanRate);
         json_object_set_new(root, "tuningName", jsonTuningName);
         json_object_set_new(root, "scale", jsonScale);
         return root;
@@ -639,15 +939,21 @@ struct XenQnt : Module {
         json_t *jsonTuningName = json_object_get(root, "tuningName");
         json_t *jsonInputMappingMode = json_object_get(root, "inputMappingMode");
         json_t *jsonCvMappingMode = json_object_get(root, "cvMappingMode");
+        json_t *jsonCvScanRate = json_object_get(root, "cvScanRate");
         if (jsonInputMappingMode) {
-            inputMappingMode = static_cast<MappingMode>(json_integer_value(jsonInputMappingMode));
+            setInputMappingMode(static_cast<MappingMode>(json_integer_value(jsonInputMappingMode)));
         } else {
-            inputMappingMode = proximity;
+            setInputMappingMode(proximity);
         }
         if (jsonCvMappingMode) {
-            cvMappingMode = static_cast<MappingMode>(json_integer_value(jsonCvMappingMode));
+            setCvMappingMode(static_cast<MappingMode>(json_integer_value(jsonCvMappingMode)));
         } else {
-            cvMappingMode = proximity;
+            setCvMappingMode(proximity);
+        }
+        if (jsonCvScanRate) {
+            setCvScanRate(static_cast<CvScanRate>(json_integer_value(jsonCvScanRate)));
+        } else {
+            setCvScanRate(cvScan1Ms);
         }
         if (jsonTuningName) {
             setTuningName(json_string_value(jsonTuningName));
@@ -655,16 +961,16 @@ struct XenQnt : Module {
             setTuningName("Unknown");
         }
         if (jsonScale) {
-            newScale.clear();
+            vector<ScaleStep> steps;
             size_t i;
             json_t *val;
             json_array_foreach(jsonScale, i, val) {
                 json_t *cents = json_object_get(val, "cents");
                 json_t *enabled = json_object_get(val, "enabled");
-                newScale.push_back(ScaleStep{json_real_value(cents), json_boolean_value(enabled) });
+                steps.push_back(ScaleStep{json_real_value(cents), json_boolean_value(enabled) });
             }
+            setScale(steps);
         }
-        tuningChangeRequested = true;
     }
 
 };
@@ -673,16 +979,14 @@ struct XenQnt : Module {
 struct MenuItemDisableAllNotes : MenuItem {
     XenQnt *xenQntModule;
     void onAction(const event::Action &e) override {
-        xenQntModule->setEnabledStatusAllSteps(false);
-        xenQntModule->tuningChangeRequested = true;
+        xenQntModule->editTuning(TuningEdit::DISABLE_ALL);
     }
 };
 
 struct MenuItemEnableAllNotes : MenuItem {
     XenQnt *xenQntModule;
     void onAction(const event::Action &e) override {
-        xenQntModule->setEnabledStatusAllSteps(true);
-        xenQntModule->tuningChangeRequested = true;
+        xenQntModule->editTuning(TuningEdit::ENABLE_ALL);
     }
 };
 
@@ -692,7 +996,6 @@ struct MenuItemHistory : MenuItem {
     void onAction(const event::Action &e) override {
         xenQntModule->updateHistory(path.c_str());
         xenQntModule->updateScale(path.c_str());
-        xenQntModule->tuningChangeRequested = true;
     }
 };
 
@@ -716,12 +1019,55 @@ struct MenuItemLoadScalaFile : MenuItem {
         if (path) {
             xenQntModule->updateHistory(path);
             xenQntModule->updateScale(path);
-            xenQntModule->tuningChangeRequested = true;
             free(path);
         }
     }
 };
 
+/*
+ * The search field of the scala library menu. It keeps the menu items below it in line with the query, so
+ * only a page of results is ever built, however large the library.
+ */
+struct ScalaLibrarySearchField : TextField {
+    XenQnt *xenQntModule;
+    Menu *menu;
+    vector<Widget *> results;
+
+    void onChange(const ChangeEvent &e) override {
+        updateResults();
+    }
+
+    void updateResults() {
+        for (auto item = results.begin(); item != results.end(); item++) {
+            menu->removeChild(*item);
+            delete *item;
+        }
+        results.clear();
+
+        vector<ScalaLibrary::Entry> entries;
+        size_t numMatches = scalaLibrary.search(text, MAX_LIBRARY_RESULTS, entries);
+        for (auto entry = entries.begin(); entry != entries.end(); entry++) {
+            MenuItemHistory *item = new MenuItemHistory();
+            item->text = entry->name;
+            item->rightText = rack::string::f("%d notes, %g cents", entry->numNotes, entry->period);
+            item->xenQntModule = xenQntModule;
+            item->path = entry->path;
+            addResult(item);
+        }
+        if (numMatches > entries.size()) {
+            int numMore = numMatches - entries.size();
+            addResult(createMenuLabel(rack::string::f("%d more, type to narrow down", numMore)));
+        } else if (numMatches == 0) {
+            addResult(createMenuLabel(scalaLibrary.isScanning() ? "Indexing..." : "No scala files found"));
+        }
+    }
+
+    void addResult(Widget *item) {
+        menu->addChild(item);
+        results.push_back(item);
+    }
+};
+
 
 struct RedOrangeLight : GrayModuleLightWidget {
     RedOrangeLight() {
@@ -776,6 +1122,42 @@ struct XenQntWidget : ModuleWidget {
 
     }
 
+    void step() override {
+        RT_AUDIT_REPORT;
+        XenQnt *module = dynamic_cast<XenQnt *>(this->getModule());
+        if (module) {
+            module->applyLoadedScale();
+            module->updateLights();
+        }
+        ModuleWidget::step();
+    }
+
+    void appendLibraryMenu(Menu *menu, XenQnt *module) {
+        std::string indexFile = asset::user(SCALA_LIBRARY_FILENAME);
+        // the saved index is checked for changes in the background, the menu shows what's known so far
+        scalaLibrary.update(indexFile, module->scalaDir);
+        std::string root = scalaLibrary.getRoot();
+        menu->addChild(createMenuLabel("Folder: " + (root.empty() ? module->scalaDir : root)));
+        if (!root.empty() and !module->scalaDir.empty() and module->scalaDir != root) {
+            menu->addChild(createMenuItem("Use the current scala folder", "", [ = ]() {
+                scalaLibrary.setRoot(indexFile, module->scalaDir);
+            }));
+        }
+        if (!root.empty()) {
+            menu->addChild(createMenuItem("Rescan the folder", "", [ = ]() {
+                scalaLibrary.rescan(indexFile);
+            }));
+        }
+        menu->addChild(new MenuSeparator());
+        ScalaLibrarySearchField *searchField = new ScalaLibrarySearchField();
+        searchField->box.size.x = 250;
+        searchField->placeholder = "Search";
+        searchField->xenQntModule = module;
+        searchField->menu = menu;
+        menu->addChild(searchField);
+        searchField->updateResults();
+    }
+
     void appendContextMenu(Menu *menu) override {
 
         XenQnt *module = dynamic_cast<XenQnt *>(this->getModule());
@@ -786,11 +1168,11 @@ struct XenQntWidget : ModuleWidget {
         menu->addChild(createMenuLabel("Tuning: " + module->tuningName));
 
         menu->addChild(createSubmenuItem("Change tuning", "", [ = ](ui::Menu * menu) {
-            module->loadHistory();
-            if (module->history.size() < 2) { // Note: if there's only one tuning, it must be the current one
+            list<std::string> history = module->loadHistory();
+            if (history.size() < 2) { // Note: if there's only one tuning, it must be the current one
                 menu->addChild(createMenuLabel("History: empty"));
             } else {
-                for (auto entry = module->history.begin(); entry != module->history.end(); entry++) {
+                for (auto entry = history.begin(); entry != history.end(); entry++) {
                     std::string label = getBaseName((*entry).c_str());
                     if (label.compare(module->tuningName) != 0) {
                         MenuItemHistory *menuItemHistory = new MenuItemHistory();
@@ -806,6 +1188,9 @@ struct XenQntWidget : ModuleWidget {
             loadScalaFileItem->text = "Load scala file";
             loadScalaFileItem->xenQntModule = module;
             menu->addChild(loadScalaFileItem);
+            menu->addChild(createSubmenuItem("Scala library", "", [ = ](ui::Menu * menu) {
+                appendLibraryMenu(menu, module);
+            }));
         }));
 
         MenuItemDisableAllNotes *disableAllNotesItem = new MenuItemDisableAllNotes();
@@ -821,31 +1206,37 @@ struct XenQntWidget : ModuleWidget {
 
         menu->addChild(createSubmenuItem("Mapping mode main", "", [ = ](ui::Menu * menu) {
             menu->addChild(createMenuItem("Proximity", CHECKMARK(module->inputMappingMode == proximity), [ = ]() {
-                module->inputMappingMode = proximity;
-                module->tuningChangeRequested = true;
+                module->setInputMappingMode(proximity);
             }));
             menu->addChild(createMenuItem("Proportional", CHECKMARK(module->inputMappingMode == proportional), [ = ]() {
-                module->inputMappingMode = proportional;
-                module->tuningChangeRequested = true;
+                module->setInputMappingMode(proportional);
             }));
             menu->addChild(createMenuItem("12-EDO input", CHECKMARK(module->inputMappingMode == twelveEdoInput), [ = ]() {
-                module->inputMappingMode = twelveEdoInput;
-                module->tuningChangeRequested = true;
+                module->setInputMappingMode(twelveEdoInput);
             }));
         }));
 
         menu->addChild(createSubmenuItem("Mapping mode CV", "", [ = ](ui::Menu * menu) {
             menu->addChild(createMenuItem("Proximity", CHECKMARK(module->cvMappingMode == proximity), [ = ]() {
-                module->cvMappingMode = proximity;
-                module->tuningChangeRequested = true;
+                module->setCvMappingMode(proximity);
             }));
             menu->addChild(createMenuItem("Proportional", CHECKMARK(module->cvMappingMode == proportional), [ = ]() {
-                module->cvMappingMode = proportional;
-                module->tuningChangeRequested = true;
+                module->setCvMappingMode(proportional);
             }));
             menu->addChild(createMenuItem("12-EDO input", CHECKMARK(module->cvMappingMode == twelveEdoInput), [ = ]() {
-                module->cvMappingMode = twelveEdoInput;
-                module->tuningChangeRequested = true;
+                module->setCvMappingMode(twelveEdoInput);
+            }));
+        }));
+
+        menu->addChild(createSubmenuItem("CV scan rate", "", [ = ](ui::Menu * menu) {
+            menu->addChild(createMenuItem("Every sample", CHECKMARK(module->cvScanRate == cvScanEverySample), [ = ]() {
+                module->setCvScanRate(cvScanEverySample);
+            }));
+            menu->addChild(createMenuItem("Every ms", CHECKMARK(module->cvScanRate == cvScan1Ms), [ = ]() {
+                module->setCvScanRate(cvScan1Ms);
+            }));
+            menu->addChild(createMenuItem("Every 10 ms", CHECKMARK(module->cvScanRate == cvScan10Ms), [ = ]() {
+                module->setCvScanRate(cvScan10Ms);
             }));
         }));
 
@@ -0,0 +1,1023 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+/*
+ * The quantization engine of XenQnt, independent of the module: tunings derived from a scale and a mask of
+ * enabled steps, and kernels that quantize a block of voltages to such a tuning.
+ */
+
+#include <rack.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#define CELL_MARGIN 1e-5 // in volts, keeps cached decision cells safely inside the actual ones
+#define MIN_VOLT (-4.f) // ~16 Hz
+#define MAX_VOLT 6.f    // ~17 kHz (if 0 V corresponds with middle C)
+#define MAX_GRID_SIZE 32768 // buckets per period, beyond this the lower bound falls back to a search tree
+#define TIE_MARGIN 1e-9 // in volts, the 12-EDO mapping leaves nearest pitches closer than this to a search
+
+/*
+ * Represents a value in the scala file
+ */
+struct ScaleStep {
+    double cents;
+    bool enabled;
+};
+
+/*
+ * The enabled steps of a scale, one bit per step. Copies, comparisons and changes to all steps work a word
+ * at a time. The bits beyond the last step are always 0, so equal masks have equal words.
+ */
+struct StepMask {
+    std::vector<uint64_t> words;
+    int numSteps = 0;
+
+    StepMask() {}
+
+    StepMask(int numSteps, bool enabled) : words((numSteps + 63) / 64), numSteps(numSteps) {
+        setAll(enabled);
+    }
+
+    // the enabled steps of a scale
+    explicit StepMask(const std::vector<ScaleStep> &scale) : StepMask(scale.size(), false) {
+        for (size_t k = 0; k < scale.size(); k++) {
+            set(k, scale[k].enabled);
+        }
+    }
+
+    int size() const {
+        return numSteps;
+    }
+
+    bool test(int k) const {
+        return (words[k / 64] >> (k % 64)) & 1;
+    }
+
+    void set(int k, bool enabled) {
+        if (enabled) {
+            words[k / 64] |= uint64_t(1) << (k % 64);
+        } else {
+            words[k / 64] &= ~(uint64_t(1) << (k % 64));
+        }
+    }
+
+    void flip(int k) {
+        words[k / 64] ^= uint64_t(1) << (k % 64);
+    }
+
+    void setAll(bool enabled) {
+        std::fill(words.begin(), words.end(), enabled ? ~uint64_t(0) : 0);
+        clearPadding();
+    }
+
+    // enable each step with a chance of one half
+    void randomize() {
+        for (auto w = words.begin(); w != words.end(); w++) {
+            *w = 0;
+            // rand() is only guaranteed to give 15 random bits
+            for (int i = 0; i < 64; i += 15) {
+                *w = (*w << 15) ^ (uint64_t) rand();
+            }
+        }
+        clearPadding();
+    }
+
+    int count() const {
+        int count = 0;
+        for (auto w = words.begin(); w != words.end(); w++) {
+            count += __builtin_popcountll(*w);
+        }
+        return count;
+    }
+
+    // Call f(k) for every enabled step k, in ascending order
+    template <typename F>
+    void forEachEnabled(F f) const {
+        for (size_t i = 0; i < words.size(); i++) {
+            for (uint64_t bits = words[i]; bits != 0; bits &= bits - 1) {
+                f(i * 64 + __builtin_ctzll(bits));
+            }
+        }
+    }
+
+    // Call f(k) for every step k that differs from the other mask, which must be of the same size
+    template <typename F>
+    void forEachDifference(const StepMask &other, F f) const {
+        for (size_t i = 0; i < words.size(); i++) {
+            for (uint64_t diff = words[i] ^ other.words[i]; diff != 0; diff &= diff - 1) {
+                f(i * 64 + __builtin_ctzll(diff));
+            }
+        }
+    }
+
+    bool operator==(const StepMask &other) const {
+        return numSteps == other.numSteps and words == other.words;
+    }
+
+    bool operator!=(const StepMask &other) const {
+        return !(*this == other);
+    }
+
+    void clearPadding() {
+        if (numSteps % 64 != 0) {
+            words.back() &= (uint64_t(1) << (numSteps % 64)) - 1;
+        }
+    }
+};
+
+// The cents of a scale, without the enabled status of its steps
+inline std::vector<double> getCents(const std::vector<ScaleStep> &scale) {
+    std::vector<double> cents;
+    for (auto step = scale.begin(); step != scale.end(); step++) {
+        cents.push_back(step->cents);
+    }
+    return cents;
+}
+
+// The scale with the given cents and enabled steps
+inline std::vector<ScaleStep> getScaleSteps(const std::vector<double> &cents, const StepMask &enabledSteps) {
+    std::vector<ScaleStep> scale;
+    for (size_t k = 0; k < cents.size(); k++) {
+        scale.push_back({cents[k], enabledSteps.test(k)});
+    }
+    return scale;
+}
+
+/*
+ * Represents a step in the actual tuning
+ */
+struct TuningStep {
+    double voltage;
+    int scaleIndex; // points to corresponding value in the scala file
+};
+
+/*
+ * A bucket of the lookup grid over a period. It holds at most one step of the period (the split), so the
+ * rank of any voltage in the bucket is either base or base + 1.
+ */
+struct GridBucket {
+    float split; // the step in this bucket, or infinity if there is none
+    int base;    // the number of steps in the buckets below
+};
+
+/*
+ * Finds the rank of a voltage within a period: the number of steps of the scale below it. It's built once per
+ * scale and shared by the tables of all and of the enabled pitches, and by every snapshot of the scale, so
+ * enabling and disabling steps never touches it. A uniform grid over the period, with buckets narrow enough
+ * to hold one step each, gives the rank with a multiplication and a comparison. If that takes more than
+ * MAX_GRID_SIZE buckets, a float copy of the steps in Eytzinger (breadth-first) order is searched instead,
+ * padded with infinity to a perfect tree of depth levels (index 0 is unused). Both work in float, so the
+ * rank is only an estimate.
+ */
+struct PeriodSearch {
+
+    std::vector<GridBucket> grid;
+    float gridScale = 0.f; // buckets per volt
+    std::vector<float> tree;
+    int depth = 0;
+
+    // scaleSteps are the steps of the scale in volts (cents / 1200), in ascending order
+    PeriodSearch(const std::vector<double> &scaleSteps, double periodVolts) {
+        // a voltage within the period lies below the period itself, so only the steps below it can count
+        std::vector<float> steps;
+        for (size_t k = 0; k < scaleSteps.size() and scaleSteps[k] < periodVolts; k++) {
+            steps.push_back(scaleSteps[k]);
+        }
+
+        // The buckets are half the smallest distance between two steps wide, which leaves at most one step
+        // per bucket. Rounding may still put two steps in one bucket, in which case we double the resolution.
+        float period = periodVolts;
+        float minDistance = period;
+        for (size_t i = 1; i < steps.size(); i++) {
+            minDistance = std::min(minDistance, steps[i] - steps[i - 1]);
+        }
+        size_t gridSize = minDistance > 0 ? std::ceil(2 * period / minDistance) : MAX_GRID_SIZE + 1;
+        for (; gridSize <= MAX_GRID_SIZE and grid.empty(); gridSize *= 2) {
+            gridScale = gridSize / period;
+            grid.assign(gridSize, {INFINITY, 0});
+            int lastBucket = -1;
+            for (size_t i = 0; i < steps.size() and !grid.empty(); i++) {
+                int bucket = getGridBucket(steps[i]);
+                if (bucket == lastBucket) {
+                    grid.clear();
+                } else {
+                    grid[bucket].split = steps[i];
+                    lastBucket = bucket;
+                }
+            }
+        }
+        // the base of a bucket counts the steps in all buckets below
+        int base = 0;
+        for (auto b = grid.begin(); b != grid.end(); b++) {
+            b->base = base;
+            if (b->split != INFINITY) {
+                base++;
+            }
+        }
+
+        if (grid.empty()) {
+            gridScale = 0.f;
+            while ((1u << depth) - 1 < steps.size()) {
+                depth++;
+            }
+            tree.assign(1 << depth, INFINITY);
+            size_t i = 0;
+            fillTree(1, steps, i);
+        }
+    }
+
+    // The number of steps below u, for u within the period
+    int rank(float u) const {
+        if (!grid.empty()) {
+            const GridBucket &bucket = grid[getGridBucket(u)];
+            return bucket.base + (bucket.split < u ? 1 : 0);
+        }
+        int node = 1;
+        for (int level = 0; level < depth; level++) {
+            node = 2 * node + (tree[node] < u ? 1 : 0);
+        }
+        return node - (1 << depth);
+    }
+
+    // The same for four voltages at once: one multiply, one index and one compare per lane on the grid, and
+    // the same number of steps for all lanes in the (perfect) search tree
+    rack::simd::int32_4 rank(rack::simd::float_4 u) const {
+        using rack::simd::float_4;
+        using rack::simd::int32_4;
+        if (!grid.empty()) {
+            int32_4 b(rack::simd::clamp(u * gridScale, 0.f, (float) grid.size() - 1));
+            const GridBucket &b0 = grid[b.s[0]], &b1 = grid[b.s[1]], &b2 = grid[b.s[2]], &b3 = grid[b.s[3]];
+            float_4 split(b0.split, b1.split, b2.split, b3.split);
+            return int32_4(b0.base, b1.base, b2.base, b3.base) + (int32_4::cast(split < u) & int32_4(1));
+        }
+        const float *keys = tree.data();
+        int32_4 node(1);
+        for (int level = 0; level < depth; level++) {
+            float_4 key(keys[node.s[0]], keys[node.s[1]], keys[node.s[2]], keys[node.s[3]]);
+            node = node + node + (int32_4::cast(key < u) & int32_4(1));
+        }
+        return node - int32_4(1 << depth);
+    }
+
+    // The scalar equivalent of the bucket computation above
+    int getGridBucket(float u) const {
+        float x = u * gridScale;
+        return std::min(std::max(x, 0.f), (float) grid.size() - 1);
+    }
+
+    // an in-order walk of the tree visits the steps in sorted order
+    void fillTree(size_t node, const std::vector<float> &steps, size_t &i) {
+        if (node < tree.size()) {
+            fillTree(2 * node, steps, i);
+            if (i < steps.size()) {
+                tree[node] = steps[i];
+            }
+            i++;
+            fillTree(2 * node + 1, steps, i);
+        }
+    }
+};
+
+/*
+ * Where a pitch lies in a PitchTable: its period, counting from 0 V (negative below it), and its step within
+ * that period. Its voltage is then a load and an add, where a flat index would take a division first.
+ */
+struct PitchPosition {
+    int period;
+    int step;
+};
+
+inline bool operator==(PitchPosition a, PitchPosition b) {
+    return a.period == b.period and a.step == b.step;
+}
+
+inline bool operator<(PitchPosition a, PitchPosition b) {
+    return a.period < b.period or (a.period == b.period and a.step < b.step);
+}
+
+/*
+ * The pitches of a tuning within the voltage range, stored as a single period. Pitch i lies in period
+ * floor((i - numNonPositive) / period size), counting from 0 V, so any pitch can be computed in O(1) and
+ * the table doesn't grow with the voltage range. The searches work on positions, so the hot paths never
+ * divide by the period size. The voltages come out exactly as when the whole range
+ * is built period by period, because the period offsets are accumulated the same way.
+ */
+struct PitchTable {
+
+    // one period of pitches, in the order of the scale
+    std::vector<double> positiveSteps; // cents / 1200, for the periods above 0 V
+    std::vector<double> negativeSteps; // (cents - period) / 1200, for the periods at or below 0 V
+    std::vector<int> scaleIndices;
+
+    // the offsets of the periods above resp. at or below 0 V, starting with 0 V
+    std::vector<double> positiveOffsets;
+    std::vector<double> negativeOffsets;
+
+    double periodVolts = 0.0;
+    int numNonPositive = 0; // the number of pitches at or below 0 V
+    int numPitches = 0;
+
+    // The lower bound of a voltage is estimated from its period, which follows from a multiplication, and its
+    // rank among the steps of the scale (the search is shared with all tables of the scale). ranks[r] is the
+    // number of steps of this table among the first r steps of the scale, which maps that rank onto this
+    // table, and so also maps the pitches of the full table. correctLowerBound() turns the estimate into the
+    // exact lower bound.
+    std::shared_ptr<const PeriodSearch> search;
+    std::vector<int> ranks;
+
+    // derived from the above by updateBounds()
+    uint64_t periodReciprocal = 0; // 2^32 / periodSize(), rounded up
+    int basePitch = 0; // the index that the first step of the lowest period would have
+    float periodScale = 0.f; // 1 / periodVolts
+    float periodFloat = 0.f; // periodVolts
+    float numNegativePeriods = 0.f;
+    float maxPeriod = 0.f; // the index of the highest period, counting from the lowest one
+    PitchPosition first = {0, 0};
+    PitchPosition last = {0, 0};
+    double firstVoltage = 0.0;
+    double lastVoltage = 0.0;
+
+    size_t size() const {
+        return numPitches;
+    }
+
+    bool empty() const {
+        return numPitches == 0;
+    }
+
+    int periodSize() const {
+        return scaleIndices.size();
+    }
+
+    // The position of pitch i. Divides by the period size with a multiplication by its reciprocal, which is
+    // exact as long as the offset times the period size stays below 2^32; past that it can come out one over.
+    PitchPosition position(int i) const {
+        int n = periodSize();
+        uint32_t offset = i - basePitch;
+        int period = (offset * periodReciprocal) >> 32;
+        int step = offset - period * n;
+        if (step < 0) {
+            period--;
+            step += n;
+        }
+        return {period - (int) negativeOffsets.size(), step};
+    }
+
+    int index(PitchPosition p) const {
+        return numNonPositive + p.period * periodSize() + p.step;
+    }
+
+    PitchPosition next(PitchPosition p) const {
+        return p.step + 1 < periodSize() ? PitchPosition {p.period, p.step + 1} : PitchPosition {p.period + 1, 0};
+    }
+
+    PitchPosition previous(PitchPosition p) const {
+        return p.step > 0 ? PitchPosition {p.period, p.step - 1} : PitchPosition {p.period - 1, periodSize() - 1};
+    }
+
+    // Picks the tables with selects rather than a branch, which noisy inputs around 0 V would mispredict
+    double voltage(PitchPosition p) const {
+        if (p.period >= 0) {
+            return positiveOffsets[p.period] + positiveSteps[p.step];
+        } else {
+            return negativeOffsets[-p.period - 1] + negativeSteps[p.step];
+        }
+    }
+
+    int scaleIndex(PitchPosition p) const {
+        return scaleIndices[p.step];
+    }
+
+    TuningStep at(PitchPosition p) const {
+        return {voltage(p), scaleIndex(p)};
+    }
+
+    double voltage(int i) const {
+        return voltage(position(i));
+    }
+
+    int scaleIndex(int i) const {
+        return scaleIndex(position(i));
+    }
+
+    TuningStep at(int i) const {
+        return at(position(i));
+    }
+
+    TuningStep back() const {
+        return at(last);
+    }
+
+    void clear() {
+        positiveSteps.clear();
+        negativeSteps.clear();
+        scaleIndices.clear();
+        ranks.clear();
+        numNonPositive = 0;
+        numPitches = 0;
+    }
+
+    // the number of times step k of the period occurs at or below 0 V, resp. above 0 V
+    int countNonPositive(int k) const {
+        int n = periodSize();
+        return numNonPositive / n + (k >= n - numNonPositive % n ? 1 : 0);
+    }
+
+    int countPositive(int k) const {
+        int n = periodSize();
+        return (numPitches - numNonPositive) / n + (k < (numPitches - numNonPositive) % n ? 1 : 0);
+    }
+
+    // the number of times step k occurs below 0 V (only the period right below 0 V can reach 0 V itself)
+    int countNegative(int k) const {
+        int count = countNonPositive(k);
+        return count > 0 and negativeSteps[k] >= 0 ? count - 1 : count;
+    }
+
+    // The position of the first pitch at or above v, as std::lower_bound would find it in the full table.
+    // next(last) if there is none. The table must not be empty.
+    PitchPosition lowerBound(double v) const {
+        return correctLowerBound(estimateLowerBound((float) v), v);
+    }
+
+    // The exact lower bound of v, from an estimate that may be off by a pitch or so
+    PitchPosition correctLowerBound(PitchPosition p, double v) const {
+        if (!(v > firstVoltage)) { // also catches NaN
+            return first;
+        }
+        if (v > lastVoltage) {
+            return next(last);
+        }
+        if (p.step == periodSize()) { // ranked above all steps of the period
+            p = {p.period + 1, 0};
+        }
+        PitchPosition second = next(first);
+        p = p < second ? second : last < p ? last : p;
+        while (voltage(previous(p)) >= v) {
+            p = previous(p);
+        }
+        while (voltage(p) < v) {
+            p = next(p);
+        }
+        return p;
+    }
+
+    // An estimate of the lower bound of v, from its period and its rank within that period
+    PitchPosition estimateLowerBound(float v) const {
+        float x = std::min(std::max(v * periodScale + numNegativePeriods, 0.f), maxPeriod); // NaN ends up at 0
+        int period = x;
+        float u = v - (period - numNegativePeriods) * periodFloat;
+        return {period - (int) negativeOffsets.size(), ranks[search->rank(u)]};
+    }
+
+    // The same for four voltages at once
+    void estimateLowerBound(rack::simd::float_4 v, rack::simd::int32_4 &periods, rack::simd::int32_4 &steps) const {
+        using rack::simd::float_4;
+        using rack::simd::int32_4;
+        float_4 x = rack::simd::clamp(v * periodScale + numNegativePeriods, 0.f, maxPeriod);
+        int32_4 period(x);
+        float_4 u = v - (float_4(period) - numNegativePeriods) * periodFloat;
+        int32_4 r = search->rank(u);
+        periods = period - int32_4((int) negativeOffsets.size());
+        steps = int32_4(ranks[r.s[0]], ranks[r.s[1]], ranks[r.s[2]], ranks[r.s[3]]);
+    }
+
+    // Derive the constants of the lower bound from the periods and the number of pitches
+    void updateBounds() {
+        periodReciprocal = periodSize() > 0 ? ((uint64_t(1) << 32) - 1) / periodSize() + 1 : 0;
+        basePitch = numNonPositive - periodSize() * (int) negativeOffsets.size();
+        periodScale = 1 / periodVolts;
+        periodFloat = periodVolts;
+        numNegativePeriods = negativeOffsets.size();
+        maxPeriod = negativeOffsets.size() + positiveOffsets.size() - 1;
+        if (numPitches > 0) {
+            first = position(0);
+            last = position(numPitches - 1);
+            firstVoltage = voltage(first);
+            lastVoltage = voltage(last);
+        } else {
+            first = last = {0, 0};
+            firstVoltage = lastVoltage = 0.0;
+        }
+    }
+};
+
+/*
+ * An immutable tuning: a scale along with everything the quantizer derives from it. Snapshots are replaced
+ * as a whole, so the audio thread never sees a tuning that's half updated.
+ */
+struct TuningSnapshot {
+
+    // the tuning in cents, and which of its steps are enabled
+    std::vector<double> cents;
+    StepMask enabledSteps;
+
+    // counts the edits of the scale by the user, so that anything derived from an older scale can be told apart
+    unsigned version;
+
+    // all allowed pitches/voltages in the tuning
+    PitchTable pitches;
+
+    // used by the 12-EDO and proportional mapping algorithms
+    int numNegativeVoltages;
+    int numEnabledNegativeVoltages;
+    int numEnabledSteps;
+
+    // all enabled pitches/voltages
+    PitchTable enabledPitches;
+
+    // for each step of the scale, its nearest enabled pitch in the same or a neighbouring period (relative to
+    // the step), so that the 12-EDO mapping can do without a search. The step is -1 for the close calls.
+    std::vector<PitchPosition> nearestEnabledSteps;
+
+    // the period of the tuning in volts
+    double periodVolts;
+};
+
+/*
+ * Derives the tuning of a scale and keeps it up to date as its steps get enabled and disabled. Only a new
+ * scale rebuilds the table of all pitches, the enabled pitches are updated step by step.
+ */
+struct TuningBuilder {
+
+    // the tuning so far (its version is up to the caller)
+    TuningSnapshot current;
+
+    // Derive everything from a new scale, which must be sorted and have a positive period
+    void setScale(const std::vector<double> &cents, const StepMask &enabledSteps) {
+        current.cents = cents;
+        current.enabledSteps = enabledSteps;
+        buildPitches();
+        updateEnabledPitches();
+        current.enabledPitches.updateBounds();
+        updateNearestEnabledSteps();
+    }
+
+    // Bring the enabled pitches up to date with the enabled steps of the same scale. Only the steps that
+    // have been toggled get inserted into or removed from the enabled period.
+    void setEnabledSteps(const StepMask &enabledSteps) {
+        enabledSteps.forEachDifference(current.enabledSteps, [this](int k) {
+            current.enabledSteps.flip(k);
+            toggleEnabledPitches(k);
+        });
+        current.enabledPitches.updateBounds();
+        updateNearestEnabledSteps();
+    }
+
+    // Derive the table of all allowed pitches from the scale. Within a period the voltages increase with the
+    // scale steps, so only the period that crosses the edge of the voltage range has to be checked step by step.
+    void buildPitches() {
+
+        const std::vector<double> &cents = current.cents;
+        PitchTable &pitches = current.pitches;
+        pitches.clear();
+        pitches.positiveOffsets.clear();
+        pitches.negativeOffsets.clear();
+        double period = cents.back();
+        pitches.periodVolts = period / 1200;
+        for (size_t k = 0; k < cents.size(); k++) {
+            pitches.positiveSteps.push_back(cents[k] / 1200);
+            pitches.negativeSteps.push_back((cents[k] - period) / 1200);
+            pitches.scaleIndices.push_back(k);
+        }
+        int n = cents.size();
+        pitches.search = std::make_shared<PeriodSearch>(pitches.positiveSteps, pitches.periodVolts);
+        for (int r = 0; r <= n; r++) {
+            pitches.ranks.push_back(r);
+        }
+
+        // First count the non-positive voltages (from high to low)
+        // the offset to indicate in which period (e.g. octave for octave-repeating tunings) we are
+        double periodOffset = 0.f;
+        bool done = false;
+        while (!done) {
+            pitches.negativeOffsets.push_back(periodOffset);
+            if (periodOffset + pitches.negativeSteps.front() >= MIN_VOLT) {
+                pitches.numNonPositive += n;
+            } else {
+                for (int k = n - 1; k >= 0 and periodOffset + pitches.negativeSteps[k] >= MIN_VOLT; k--) {
+                    pitches.numNonPositive++;
+                }
+                done = true;
+            }
+            periodOffset -= period / 1200;
+        }
+
+        // Now count the positive voltages
+        int numPositive = 0;
+        periodOffset = 0.f;
+        done = false;
+        while (!done) {
+            pitches.positiveOffsets.push_back(periodOffset);
+            if (periodOffset + pitches.positiveSteps.back() <= MAX_VOLT) {
+                numPositive += n;
+            } else {
+                for (int k = 0; k < n and periodOffset + pitches.positiveSteps[k] <= MAX_VOLT; k++) {
+                    numPositive++;
+                }
+                done = true;
+            }
+            periodOffset += period / 1200;
+        }
+
+        pitches.numPitches = pitches.numNonPositive + numPositive;
+        pitches.updateBounds();
+        current.numNegativeVoltages = pitches.numNonPositive - 1;
+        current.periodVolts = pitches.periodVolts;
+    }
+
+    // Derive the enabled pitches from all pitches: a period with only the enabled steps
+    void updateEnabledPitches() {
+        const PitchTable &pitches = current.pitches;
+        PitchTable &enabledPitches = current.enabledPitches;
+        enabledPitches = pitches;
+        enabledPitches.clear();
+        enabledPitches.ranks.assign(pitches.periodSize() + 1, 0);
+        current.numEnabledNegativeVoltages = 0;
+        current.numEnabledSteps = 0;
+        current.enabledSteps.forEachEnabled([this](int k) {
+            toggleEnabledPitches(k);
+        });
+    }
+
+    // Insert or remove step k of the scale (according to its enabled status) in the enabled period
+    void toggleEnabledPitches(int k) {
+        const PitchTable &pitches = current.pitches;
+        PitchTable &enabledPitches = current.enabledPitches;
+        std::vector<int> &scaleIndices = enabledPitches.scaleIndices;
+        int i = std::lower_bound(scaleIndices.begin(), scaleIndices.end(), k) - scaleIndices.begin();
+        int delta;
+        if (current.enabledSteps.test(k)) {
+            enabledPitches.positiveSteps.insert(enabledPitches.positiveSteps.begin() + i, pitches.positiveSteps[k]);
+            enabledPitches.negativeSteps.insert(enabledPitches.negativeSteps.begin() + i, pitches.negativeSteps[k]);
+            scaleIndices.insert(scaleIndices.begin() + i, k);
+            delta = 1;
+        } else {
+            enabledPitches.positiveSteps.erase(enabledPitches.positiveSteps.begin() + i);
+            enabledPitches.negativeSteps.erase(enabledPitches.negativeSteps.begin() + i);
+            scaleIndices.erase(scaleIndices.begin() + i);
+            delta = -1;
+        }
+        for (size_t r = k + 1; r < enabledPitches.ranks.size(); r++) {
+            enabledPitches.ranks[r] += delta;
+        }
+        // step k contributes a pitch to every period in which the full table has one
+        enabledPitches.numNonPositive += delta * pitches.countNonPositive(k);
+        enabledPitches.numPitches += delta * (pitches.countNonPositive(k) + pitches.countPositive(k));
+        current.numEnabledNegativeVoltages += delta * pitches.countNegative(k);
+        current.numEnabledSteps += delta;
+    }
+
+    // Find the nearest enabled pitch of every step, between the enabled steps ranked just below and above it.
+    // The other periods round their voltages differently, so decisions within TIE_MARGIN are left out, and so
+    // are enabled steps below the step with the very same voltage (getPitchByProximity takes the first one).
+    void updateNearestEnabledSteps() {
+        const PitchTable &pitches = current.pitches;
+        const PitchTable &enabledPitches = current.enabledPitches;
+        std::vector<PitchPosition> &nearest = current.nearestEnabledSteps;
+        int n = pitches.periodSize();
+        int m = enabledPitches.periodSize();
+        nearest.assign(n, PitchPosition {0, -1});
+        if (m == 0) {
+            return;
+        }
+        const std::vector<double> &steps = enabledPitches.positiveSteps;
+        for (int k = 0; k < n; k++) {
+            double v = pitches.positiveSteps[k];
+            int r = enabledPitches.ranks[k];
+            PitchPosition ceil = r < m ? PitchPosition {0, r} : PitchPosition {1, 0};
+            PitchPosition floor = r > 0 ? PitchPosition {0, r - 1} : PitchPosition {-1, m - 1};
+            double ceilDistance = steps[ceil.step] + ceil.period * pitches.periodVolts - v;
+            double floorDistance = v - (steps[floor.step] + floor.period * pitches.periodVolts);
+            if (floorDistance > TIE_MARGIN and std::fabs(ceilDistance - floorDistance) > TIE_MARGIN) {
+                nearest[k] = ceilDistance > floorDistance ? floor : ceil;
+            }
+        }
+    }
+};
+
+// Build the tuning of a scale, with the enabled steps as its mask
+inline TuningSnapshot buildTuning(const std::vector<ScaleStep> &scale, unsigned version = 0) {
+    TuningBuilder builder;
+    builder.setScale(getCents(scale), StepMask(scale));
+    builder.current.version = version;
+    return builder.current;
+}
+
+/*
+ * The decision cells of the last quantized input, one per channel. As long as the input of a channel stays
+ * within [low, high], its output stays the same, so there's no need to search again.
+ */
+struct CellCache {
+    float low[PORT_MAX_CHANNELS];
+    float high[PORT_MAX_CHANNELS];
+    float volts[PORT_MAX_CHANNELS];
+    int scaleIndices[PORT_MAX_CHANNELS];
+
+    CellCache() {
+        invalidate();
+    }
+
+    // empty cells, so that every channel gets quantized again
+    void invalidate() {
+        std::fill(low, low + PORT_MAX_CHANNELS, INFINITY);
+        std::fill(high, high + PORT_MAX_CHANNELS, -INFINITY);
+    }
+
+    void set(int c, float volt, int scaleIndex, double low, double high) {
+        volts[c] = volt;
+        scaleIndices[c] = scaleIndex;
+        this->low[c] = low + CELL_MARGIN;
+        this->high[c] = high - CELL_MARGIN;
+    }
+};
+
+
+enum MappingMode { proximity, proportional, twelveEdoInput };
+
+
+/*
+ * Quantizes blocks of voltages to a tuning, which is owned by the caller. The enabled kernels cache the
+ * decision cell of every channel, so use one quantizer per input.
+ */
+struct Quantizer {
+
+    // the tuning to quantize to
+    const TuningSnapshot *tuning = nullptr;
+
+    // the decision cells of the last quantized block, invalidated whenever the tuning changes
+    CellCache cells;
+
+    // A kernel quantizes a block of channels for one (mapping mode, enabled) combination. They're picked
+    // when the mapping mode is set, so there is no mode dispatch per sample.
+    typedef void (Quantizer::*Kernel)(const float *in, int numChannels, float *out, int *scaleIndices);
+
+    typedef rack::simd::float_4 float_4;
+
+    void setTuning(const TuningSnapshot *tuning) {
+        this->tuning = tuning;
+        cells.invalidate();
+    }
+
+    template <bool ENABLED>
+    static Kernel getKernel(MappingMode mode) {
+        switch (mode) {
+        case proportional:
+            return &Quantizer::quantize<proportional, ENABLED>;
+        case twelveEdoInput:
+            return &Quantizer::quantize<twelveEdoInput, ENABLED>;
+        case proximity:
+        default:
+            return &Quantizer::quantize<proximity, ENABLED>;
+        }
+    }
+
+    // Quantize a block of channels. The enabled kernels run four channels at a time, so in and out must have
+    // room for PORT_MAX_CHANNELS values. Their results are bit-identical to the scalar mapping functions below.
+    template <MappingMode MODE, bool ENABLED>
+    void quantize(const float *in, int numChannels, float *out, int *scaleIndices) {
+        if (!ENABLED) {
+            for (int i = 0; i < numChannels; i++) {
+                TuningStep step = MODE == proportional ? getPitchProportional<false>(in[i]) :
+                                  MODE == twelveEdoInput ? getPitchFrom12Edo<false>(in[i]) : getPitchByProximity<false>(in[i]);
+                out[i] = step.voltage;
+                scaleIndices[i] = step.scaleIndex;
+            }
+        } else {
+            for (int c = 0; c < numChannels; c += 4) {
+                float_4 v = float_4::load(in + c);
+                // only search again if a channel has left its decision cell
+                float_4 inCell = (v >= float_4::load(cells.low + c)) & (v <= float_4::load(cells.high + c));
+                if (rack::simd::movemask(inCell) != 0xf) {
+                    if (tuning->enabledPitches.empty() and MODE != twelveEdoInput) {
+                        quantizeSilent(c);
+                    } else if (MODE == proportional) {
+                        quantizeProportional(v, c);
+                    } else if (MODE == twelveEdoInput) {
+                        quantize12Edo(v, c);
+                    } else {
+                        quantizeByProximity(v, c);
+                    }
+                }
+                float_4::load(cells.volts + c).store(out + c);
+            }
+            std::copy(cells.scaleIndices, cells.scaleIndices + numChannels, scaleIndices);
+        }
+    }
+
+    // The kernels below quantize channels c to c + 3 into the cell cache
+
+    // 0 V if there are no enabled pitches in the tuning
+    inline void quantizeSilent(int c) {
+        for (int i = c; i < c + 4; i++) {
+            cells.set(i, 0.f, tuning->cents.size() - 1, -INFINITY, INFINITY);
+        }
+    }
+
+    inline void quantizeProportional(float_4 v, int c) {
+        const PitchTable &enabledPitches = tuning->enabledPitches;
+        int n = enabledPitches.size();
+        for (int i = 0; i < 4; i++) {
+            int index = getProportionalIndex(v.s[i], n, tuning->numEnabledNegativeVoltages, tuning->numEnabledSteps);
+            // the cell is the inverse image of the rounding, unless the index got clamped
+            double stepVolts = tuning->periodVolts / tuning->numEnabledSteps;
+            double low = index == 0 ? -INFINITY : (index - tuning->numEnabledNegativeVoltages - 0.5) * stepVolts;
+            double high = index == n - 1 ? INFINITY : (index - tuning->numEnabledNegativeVoltages + 0.5) * stepVolts;
+            PitchPosition p = enabledPitches.position(index);
+            cells.set(c + i, enabledPitches.voltage(p), enabledPitches.scaleIndex(p), low, high);
+        }
+    }
+
+    // The 12-EDO step is clamped to the full tuning before looking for the nearest enabled pitch
+    inline void quantize12Edo(float_4 v, int c) {
+        const PitchTable &pitches = tuning->pitches;
+        const PitchTable &enabledPitches = tuning->enabledPitches;
+        for (int i = 0; i < 4; i++) {
+            double semitone = std::round((double) v.s[i] * 12);
+            double pitchIndex = tuning->numNegativeVoltages + semitone;
+            // the cell is the 12-EDO step, open-ended where the step got clamped
+            double low = (semitone - 0.5) / 12;
+            double high = (semitone + 0.5) / 12;
+            if (!(pitchIndex >= 0)) {
+                cells.set(c + i, pitches.voltage(pitches.first), pitches.scaleIndex(pitches.first), -INFINITY, high);
+            } else if (pitchIndex >= pitches.size()) {
+                cells.set(c + i, pitches.voltage(pitches.last), pitches.scaleIndex(pitches.last), low, INFINITY);
+            } else if (enabledPitches.empty()) {
+                cells.set(c + i, 0.f, tuning->cents.size() - 1, low, high);
+            } else {
+                PitchPosition p = nearestEnabledTo(pitches.position((int) pitchIndex));
+                cells.set(c + i, enabledPitches.voltage(p), enabledPitches.scaleIndex(p), low, high);
+            }
+        }
+    }
+
+    inline void quantizeByProximity(float_4 v, int c) {
+        const PitchTable &enabledPitches = tuning->enabledPitches;
+        rack::simd::int32_4 periods, steps;
+        enabledPitches.estimateLowerBound(v, periods, steps);
+        for (int i = 0; i < 4; i++) {
+            PitchPosition estimate = {periods.s[i], steps.s[i]};
+            PitchPosition p = nearestEnabled(enabledPitches.correctLowerBound(estimate, v.s[i]), v.s[i]);
+            double voltage = enabledPitches.voltage(p);
+            // the cell is bounded by the midpoints to the neighbouring pitches
+            double low = p == enabledPitches.first ? -INFINITY :
+                         (enabledPitches.voltage(enabledPitches.previous(p)) + voltage) / 2;
+            double high = p == enabledPitches.last ? INFINITY :
+                          (voltage + enabledPitches.voltage(enabledPitches.next(p))) / 2;
+            cells.set(c + i, voltage, enabledPitches.scaleIndex(p), low, high);
+        }
+    }
+
+    // The nearest enabled pitch to pitch p of all pitches, as getPitchByProximity would find it
+    inline PitchPosition nearestEnabledTo(PitchPosition p) {
+        const PitchTable &enabledPitches = tuning->enabledPitches;
+        PitchPosition nearest = tuning->nearestEnabledSteps[p.step];
+        if (nearest.step >= 0) {
+            nearest.period += p.period;
+            if (!(nearest < enabledPitches.first) and !(enabledPitches.last < nearest)) {
+                return nearest;
+            }
+        }
+        // a close call or the end of the range: search from the rank of the step in the same period
+        double v = tuning->pitches.voltage(p);
+        PitchPosition ceil = {p.period, enabledPitches.ranks[p.step]};
+        return nearestEnabled(enabledPitches.correctLowerBound(ceil, v), v);
+    }
+
+    // Pick the nearest enabled pitch around its lower bound, like getPitchByProximity
+    inline PitchPosition nearestEnabled(PitchPosition ceil, double v) {
+        const PitchTable &enabledPitches = tuning->enabledPitches;
+        if (ceil == enabledPitches.first) {
+            return ceil;
+        } else if (enabledPitches.last < ceil) {
+            return enabledPitches.last;
+        }
+        PitchPosition floor = enabledPitches.previous(ceil);
+        if ((enabledPitches.voltage(ceil) - v) > (v - enabledPitches.voltage(floor))) {
+            return floor;
+        } else {
+            return ceil;
+        }
+    }
+
+    // Index into a table of numPitches pitches with numSteps pitches per period, numNegative of them below
+    // 0 V. The kernel and getPitchProportional both go through here, so that they round the same way even
+    // when the compiler reassociates the division (-funsafe-math-optimizations).
+    inline int getProportionalIndex(double v, int numPitches, int numNegative, int numSteps) {
+        double period = tuning->cents.back() / 1200;
+        double pitchIndex = numNegative + std::round(v / period * numSteps);
+        if (!(pitchIndex >= 0)) { // also catches NaN
+            return 0;
+        }
+        if (pitchIndex >= numPitches) {
+            return numPitches - 1;
+        }
+        return pitchIndex;
+    }
+
+    // Proportional mapping: all pitches in the tuning have an inverse image of the same size
+    template <bool ENABLED>
+    inline TuningStep getPitchProportional(double v) {
+
+        const PitchTable *_pitches;
+        int numNegative;
+        int numSteps;
+
+        if (ENABLED) {
+            _pitches = &tuning->enabledPitches;
+            numNegative = tuning->numEnabledNegativeVoltages;
+            numSteps = tuning->numEnabledSteps;
+        } else {
+            _pitches = &tuning->pitches;
+            numNegative = tuning->numNegativeVoltages;
+            numSteps = tuning->cents.size();
+        }
+
+        // return 0 V if there are no (enabled) pitches in the tuning
+        if (_pitches->empty()) {
+            int rootIdx = tuning->cents.size() - 1;
+            return {0.0, rootIdx};
+        }
+
+        return _pitches->at(getProportionalIndex(v, _pitches->size(), numNegative, numSteps));
+    }
+
+    // Map consecutive 12-EDO pitches to consecutive pitches in the target tuning, with 0 V <-> 0 V
+    template <bool ENABLED>
+    inline TuningStep getPitchFrom12Edo(double v) {
+
+        // return 0 V if there are no (enabled) pitches in the tuning
+        if (tuning->pitches.empty()) {
+            int rootIdx = tuning->cents.size() - 1;
+            return {0.0, rootIdx};
+        }
+
+        int pitchIndex = tuning->numNegativeVoltages + std::round(v * 12);
+
+        if (pitchIndex < 0) {
+            return tuning->pitches.at(0);
+        }
+
+        if (pitchIndex >= (int) tuning->pitches.size()) {
+            return tuning->pitches.back();
+        }
+
+        if (ENABLED) {
+            // the nearest enabled pitch, as getPitchByProximity would find it
+            if (tuning->enabledPitches.empty()) {
+                int rootIdx = tuning->cents.size() - 1;
+                return {0.0, rootIdx};
+            }
+            return tuning->enabledPitches.at(nearestEnabledTo(tuning->pitches.position(pitchIndex)));
+        } else {
+            return tuning->pitches.at(pitchIndex);
+        }
+    }
+
+    // get the nearest allowable pitch
+    template <bool ENABLED>
+    inline TuningStep getPitchByProximity(double v) {
+
+        const PitchTable *_pitches = &tuning->pitches;
+        if (ENABLED) {
+            _pitches = &tuning->enabledPitches;
+        }
+
+        // return 0 V if there are no (enabled) pitches in the tuning
+        if (_pitches->empty()) {
+            int rootIdx = tuning->cents.size() - 1;
+            return {0.0, rootIdx};
+        }
+
+        PitchPosition ceil = _pitches->lowerBound(v);
+        if (ceil == _pitches->first) {
+            return _pitches->at(ceil);
+        } else if (_pitches->last < ceil) {
+            return _pitches->at(_pitches->last);
+        } else {
+            PitchPosition floor = _pitches->previous(ceil);
+            if ((_pitches->voltage(ceil) - v) > (v - _pitches->voltage(floor))) {
+                return _pitches->at(floor);
+            } else {
+                return _pitches->at(ceil);
+            }
+        }
+    }
+};
@@ -0,0 +1,111 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#include "rtaudit.hpp"
+
+#ifdef H4N4_RT_AUDIT
+
+#include "plugin.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static thread_local int realtimeDepth = 0;
+static std::atomic<size_t> violationCount(0);
+static size_t reportedCount = 0;
+
+static void checkRealtime() {
+    if (realtimeDepth > 0) {
+#ifdef H4N4_RT_AUDIT_TRAP
+        abort();
+#endif
+        violationCount++;
+    }
+}
+
+static void *allocate(size_t size) {
+    checkRealtime();
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+static void deallocate(void *p) {
+    if (p) {
+        checkRealtime();
+        free(p);
+    }
+}
+
+void *operator new(size_t size) {
+    return allocate(size);
+}
+
+void *operator new[](size_t size) {
+    return allocate(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    checkRealtime();
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    checkRealtime();
+    return malloc(size ? size : 1);
+}
+
+void operator delete(void *p) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void *p) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+    deallocate(p);
+}
+
+namespace rtaudit {
+
+Scope::Scope() {
+    realtimeDepth++;
+}
+
+Scope::~Scope() {
+    realtimeDepth--;
+}
+
+size_t getViolationCount() {
+    return violationCount;
+}
+
+void report() {
+    size_t count = violationCount;
+    if (count != reportedCount) {
+        WARN("Realtime audit: %zu heap allocations/deallocations on the audio thread so far", count);
+        reportedCount = count;
+    }
+}
+
+}
+
+#endif
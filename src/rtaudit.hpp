@@ -0,0 +1,49 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+/*
+ * Realtime-safety audit. When built with RT_AUDIT=count (or RT_AUDIT=trap), every heap allocation or
+ * deallocation made by this plugin inside an RT_AUDIT_SCOPE is counted (or aborts the process).
+ * Without RT_AUDIT the macros compile to nothing.
+ */
+#ifdef H4N4_RT_AUDIT
+
+#include <cstddef>
+
+namespace rtaudit {
+
+// marks the calling thread as realtime for the lifetime of the scope
+struct Scope {
+    Scope();
+    ~Scope();
+};
+
+size_t getViolationCount();
+
+// log any violations since the last report (not realtime-safe itself, so call it from the UI thread)
+void report();
+
+}
+
+#define RT_AUDIT_SCOPE rtaudit::Scope rtAuditScope
+#define RT_AUDIT_REPORT rtaudit::report()
+
+#else
+
+#define RT_AUDIT_SCOPE
+#define RT_AUDIT_REPORT
+
+#endif
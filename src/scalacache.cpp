@@ -0,0 +1,131 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#include "scalacache.hpp"
+#include "utils.hpp"
+#include "tuning/Tunings.h"
+#include "tuning/TuningsImpl.h"
+#include <algorithm>
+
+
+ScalaCache scalaCache;
+
+std::vector<double> ScalaCache::read(const std::string &path) {
+    time_t modifiedTime = 0;
+    off_t size = 0;
+    bool stamped = getFileStamp(path.c_str(), modifiedTime, size);
+    if (stamped) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto entry = entries.find(path);
+        if (entry != entries.end() and entry->second.modifiedTime == modifiedTime and entry->second.size == size) {
+            entry->second.lastUsed = ++useCount;
+            return entry->second.cents;
+        }
+    }
+
+    // parse the file without holding the lock, other instances may need the cache in the meantime (the
+    // tuning is only built to reject the scales it can't map)
+    Tunings::Tuning tuning = Tunings::Tuning(Tunings::readSCLFile(path));
+    std::vector<double> cents;
+    for (auto tone = tuning.scale.tones.begin(); tone != tuning.scale.tones.end(); tone++) {
+        cents.push_back(tone->cents);
+    }
+    // sort the scale, because the Scala spec allows for unsorted scale steps
+    std::sort(cents.begin(), cents.end());
+
+    if (stamped) {
+        std::lock_guard<std::mutex> lock(mutex);
+        // the cache only grows with the number of files the user picks, but keep it bounded anyway
+        if (entries.size() >= MAX_CACHED_SCALAS and entries.find(path) == entries.end()) {
+            auto leastRecent = entries.begin();
+            for (auto entry = entries.begin(); entry != entries.end(); entry++) {
+                if (entry->second.lastUsed < leastRecent->second.lastUsed) {
+                    leastRecent = entry;
+                }
+            }
+            entries.erase(leastRecent);
+        }
+        entries[path] = {modifiedTime, size, cents, ++useCount};
+    }
+    return cents;
+}
+
+
+ScalaLoader scalaLoader;
+
+void ScalaLoader::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopRequested = true;
+    }
+    wakeUp.notify_one();
+    if (thread.joinable()) {
+        thread.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.clear();
+    stopRequested = false;
+}
+
+std::shared_ptr<ScalaLoad> ScalaLoader::load(const std::string &path) {
+    std::shared_ptr<ScalaLoad> load = std::make_shared<ScalaLoad>();
+    load->path = path;
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_front(load);
+    wake();
+    return load;
+}
+
+void ScalaLoader::prefetch(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto load = queue.begin(); load != queue.end(); load++) {
+        if ((*load)->path == path) {
+            return;
+        }
+    }
+    std::shared_ptr<ScalaLoad> load = std::make_shared<ScalaLoad>();
+    load->path = path;
+    queue.push_back(load);
+    wake();
+}
+
+void ScalaLoader::wake() {
+    if (!thread.joinable()) {
+        thread = std::thread(&ScalaLoader::run, this);
+    }
+    wakeUp.notify_one();
+}
+
+void ScalaLoader::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wakeUp.wait(lock, [this] {
+            return stopRequested or !queue.empty();
+        });
+        if (stopRequested) {
+            return;
+        }
+        std::shared_ptr<ScalaLoad> load = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        try {
+            load->cents = scalaCache.read(load->path);
+        } catch (const std::exception &e) {
+            // not just a TuningError, nothing may escape this thread
+            load->failed = true;
+        }
+        load->done = true;
+        lock.lock();
+    }
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+#define MAX_CACHED_SCALAS 64
+
+/*
+ * The scala files read so far, shared by all instances of the module, so that switching between recently
+ * used tunings (or loading the same file in several instances) takes no parsing. An entry is used only as
+ * long as the file keeps the modification time and size it had when it was read. When the cache is full,
+ * the least recently used entry makes way.
+ */
+struct ScalaCache {
+
+    struct Entry {
+        time_t modifiedTime;
+        off_t size;
+        std::vector<double> cents; // sorted
+        unsigned long lastUsed;    // the value of useCount when the entry was last read or stored
+    };
+
+    std::map<std::string, Entry> entries;
+    unsigned long useCount = 0;
+    std::mutex mutex;
+
+    // The cents of the steps in a scala file, in ascending order. Throws a Tunings::TuningError if the
+    // file can't be read or parsed. Safe to call from any thread.
+    std::vector<double> read(const std::string &path);
+};
+
+extern ScalaCache scalaCache;
+
+/*
+ * A scala file read by the ScalaLoader. Whoever asked for it polls done, after which the result is theirs.
+ */
+struct ScalaLoad {
+    std::string path;
+    std::atomic<bool> done {false};
+    bool failed = false;
+    std::vector<double> cents;
+};
+
+/*
+ * Reads scala files on a background thread (through the cache), so that a slow disk or network share never
+ * holds up the UI. Loads asked for by the user go first, prefetches are done when there's nothing else to do.
+ * The last instance of the module calls stop(), the destructor leaves the thread alone.
+ */
+struct ScalaLoader {
+
+    std::deque<std::shared_ptr<ScalaLoad>> queue;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    bool stopRequested = false;
+    std::thread thread; // started on the first request
+
+    // Drop the pending loads and stop the thread, until the next request starts it again
+    void stop();
+
+    // Read a scala file as soon as possible
+    std::shared_ptr<ScalaLoad> load(const std::string &path);
+
+    // Read a scala file into the cache once the loader is idle, in case it's needed later
+    void prefetch(const std::string &path);
+
+    void run();
+
+    // Called with the mutex held
+    void wake();
+};
+
+extern ScalaLoader scalaLoader;
@@ -0,0 +1,350 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#include "plugin.hpp"
+#include "scalalibrary.hpp"
+#include "utils.hpp"
+#include "tuning/Tunings.h"
+#include "tuning/TuningsImpl.h"
+#include <jansson.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <sstream>
+#include <dirent.h>
+
+
+ScalaLibrary scalaLibrary;
+
+static std::string toLower(std::string s) {
+    for (auto c = s.begin(); c != s.end(); c++) {
+        *c = std::tolower((unsigned char) *c);
+    }
+    return s;
+}
+
+static bool hasScalaExtension(const std::string &fileName) {
+    return fileName.size() > 4 and toLower(fileName.substr(fileName.size() - 4)) == ".scl";
+}
+
+static bool compareEntries(const ScalaLibrary::Entry &a, const ScalaLibrary::Entry &b) {
+    return a.searchText != b.searchText ? a.searchText < b.searchText : a.path < b.path;
+}
+
+static void setSearchText(ScalaLibrary::Entry &entry) {
+    entry.searchText = toLower(entry.name + " " + entry.description);
+}
+
+void ScalaLibrary::stop() {
+    stopRequested = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+    stopRequested = false;
+}
+
+void ScalaLibrary::update(const std::string &indexFile, const std::string &defaultRoot) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->indexFile = indexFile;
+    this->defaultRoot = defaultRoot;
+    requestScan();
+}
+
+void ScalaLibrary::setRoot(const std::string &indexFile, const std::string &root) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->indexFile = indexFile;
+    newRoot = root;
+    requestScan();
+}
+
+void ScalaLibrary::rescan(const std::string &indexFile) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->indexFile = indexFile;
+    rescanRequested = true;
+    requestScan();
+}
+
+std::string ScalaLibrary::getRoot() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return root;
+}
+
+bool ScalaLibrary::isScanning() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return scanning;
+}
+
+size_t ScalaLibrary::search(const std::string &query, size_t maxResults, std::vector<Entry> &results) {
+    std::vector<std::string> words;
+    std::istringstream stream(toLower(query));
+    std::string word;
+    while (stream >> word) {
+        words.push_back(word);
+    }
+    results.clear();
+    size_t numMatches = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto entry = entries.begin(); entry != entries.end(); entry++) {
+        bool match = entry->numNotes > 0;
+        for (auto w = words.begin(); w != words.end() and match; w++) {
+            match = entry->searchText.find(*w) != std::string::npos;
+        }
+        if (match) {
+            if (results.size() < maxResults) {
+                results.push_back(*entry);
+            }
+            numMatches++;
+        }
+    }
+    return numMatches;
+}
+
+void ScalaLibrary::requestScan() {
+    scanRequested = true;
+    if (!scanning) {
+        // the previous scan has finished, so this doesn't block
+        if (thread.joinable()) {
+            thread.join();
+        }
+        scanning = true;
+        thread = std::thread(&ScalaLibrary::run, this);
+    }
+}
+
+void ScalaLibrary::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (scanRequested and !stopRequested) {
+        scanRequested = false;
+        std::string indexFile = this->indexFile;
+
+        if (!indexLoaded) {
+            std::string loadedRoot;
+            time_t loadedRootModifiedTime = 0;
+            std::vector<Entry> loadedEntries;
+            lock.unlock();
+            bool loaded = loadIndex(indexFile, loadedRoot, loadedRootModifiedTime, loadedEntries);
+            lock.lock();
+            if (loaded) {
+                root = loadedRoot;
+                rootModifiedTime = loadedRootModifiedTime;
+                entries = loadedEntries;
+            }
+            indexLoaded = true;
+        }
+
+        if (!newRoot.empty()) {
+            if (newRoot != root) {
+                entries.clear();
+                rootModifiedTime = 0;
+            }
+            root = newRoot;
+            newRoot.clear();
+        } else if (root.empty()) {
+            root = defaultRoot;
+        }
+        if (root.empty()) {
+            continue;
+        }
+
+        // files added to or removed from the root folder change its modification time, anything deeper down
+        // takes a rescan asked for by the user
+        std::string scanRoot = root;
+        bool forced = rescanRequested;
+        rescanRequested = false;
+        time_t scanModifiedTime = 0;
+        off_t rootSize;
+        lock.unlock();
+        time_t now = time(nullptr);
+        bool stamped = getFileStamp(scanRoot.c_str(), scanModifiedTime, rootSize);
+        lock.lock();
+        if (!stamped or (!forced and scanModifiedTime == rootModifiedTime)) {
+            continue;
+        }
+
+        // scan a copy, so that the library can be searched in the meantime
+        std::vector<Entry> scanEntries = entries;
+        bool changed = scanModifiedTime != rootModifiedTime;
+        lock.unlock();
+        scan(scanRoot, scanEntries, changed);
+        lock.lock();
+        // the root may have been changed in the meantime, then the next pass takes care of it
+        if (!stopRequested and scanRoot == root and newRoot.empty()) {
+            entries = scanEntries;
+            // the time from before the scan, so that changes made during the scan are picked up next time. The
+            // time only has seconds, so if it's the current one, later changes in that second would go unseen.
+            time_t scannedModifiedTime = scanModifiedTime < now ? scanModifiedTime : 0;
+            rootModifiedTime = scannedModifiedTime;
+            if (changed) {
+                lock.unlock();
+                saveIndex(indexFile, scanRoot, scannedModifiedTime, scanEntries);
+                lock.lock();
+            }
+        }
+    }
+    scanning = false;
+}
+
+// Bring the entries up to date with the scala files under root. Only new and modified files are parsed.
+void ScalaLibrary::scan(const std::string &root, std::vector<Entry> &entries, bool &changed) {
+    std::vector<std::string> files;
+    findFiles(root, 0, files);
+
+    std::map<std::string, const Entry *> known;
+    for (auto entry = entries.begin(); entry != entries.end(); entry++) {
+        known[entry->path] = &*entry;
+    }
+    std::vector<Entry> scanned;
+    for (auto file = files.begin(); file != files.end() and !stopRequested; file++) {
+        Entry entry;
+        entry.path = *file;
+        if (!getFileStamp(file->c_str(), entry.modifiedTime, entry.size)) {
+            continue;
+        }
+        auto old = known.find(*file);
+        if (old != known.end() and old->second->modifiedTime == entry.modifiedTime and old->second->size == entry.size) {
+            scanned.push_back(*old->second);
+            continue;
+        }
+        changed = true;
+        entry.name = getBaseName(file->c_str());
+        entry.numNotes = 0;
+        entry.period = 0;
+        try {
+            Tunings::Scale scale = Tunings::readSCLFile(*file);
+            entry.description = scale.description;
+            entry.numNotes = scale.tones.size();
+            for (auto tone = scale.tones.begin(); tone != scale.tones.end(); tone++) {
+                entry.period = std::max(entry.period, tone->cents);
+            }
+        } catch (const std::exception &e) {
+            // not a scala file we can use, but keep it in the index so that it isn't parsed again every scan
+            entry.description.clear();
+            entry.numNotes = 0;
+        }
+        setSearchText(entry);
+        scanned.push_back(entry);
+    }
+    if (stopRequested) {
+        return;
+    }
+    changed = changed or scanned.size() != entries.size();
+    std::sort(scanned.begin(), scanned.end(), compareEntries);
+    entries.swap(scanned);
+}
+
+void ScalaLibrary::findFiles(const std::string &dir, int depth, std::vector<std::string> &files) {
+    DIR *handle = opendir(dir.c_str());
+    if (!handle) {
+        return;
+    }
+    struct dirent *item;
+    while ((item = readdir(handle)) != NULL and !stopRequested) {
+        std::string name = item->d_name;
+        if (name.empty() or name[0] == '.') {
+            continue;
+        }
+        std::string path = dir + "/" + name;
+        if (hasScalaExtension(name)) {
+            files.push_back(path);
+        } else if (depth < MAX_LIBRARY_DEPTH and exists(path.c_str())) {
+            findFiles(path, depth + 1, files);
+        }
+    }
+    closedir(handle);
+}
+
+bool ScalaLibrary::loadIndex(const std::string &indexFile, std::string &root, time_t &rootModifiedTime,
+                             std::vector<Entry> &entries) {
+    FILE *file = fopen(indexFile.c_str(), "r");
+    if (!file) {
+        return false;
+    }
+    json_error_t error;
+    json_t *jsonIndex = json_loadf(file, 0, &error);
+    fclose(file);
+    if (!jsonIndex) {
+        return false;
+    }
+
+    json_t *jsonRoot = json_object_get(jsonIndex, "root");
+    json_t *jsonScales = json_object_get(jsonIndex, "scales");
+    if (jsonRoot and jsonScales) {
+        root = json_string_value(jsonRoot) ? json_string_value(jsonRoot) : "";
+        // an index without it is scanned once more
+        rootModifiedTime = json_integer_value(json_object_get(jsonIndex, "rootModifiedTime"));
+        size_t i;
+        json_t *val;
+        json_array_foreach(jsonScales, i, val) {
+            json_t *path = json_object_get(val, "path");
+            json_t *modifiedTime = json_object_get(val, "modifiedTime");
+            json_t *size = json_object_get(val, "size");
+            json_t *description = json_object_get(val, "description");
+            json_t *numNotes = json_object_get(val, "numNotes");
+            json_t *period = json_object_get(val, "period");
+            if (json_string_value(path) and modifiedTime and size and json_string_value(description) and numNotes
+                    and period) {
+                Entry entry;
+                entry.path = json_string_value(path);
+                entry.modifiedTime = json_integer_value(modifiedTime);
+                entry.size = json_integer_value(size);
+                entry.name = getBaseName(entry.path.c_str());
+                entry.description = json_string_value(description);
+                entry.numNotes = json_integer_value(numNotes);
+                entry.period = json_real_value(period);
+                setSearchText(entry);
+                entries.push_back(entry);
+            }
+        }
+        std::sort(entries.begin(), entries.end(), compareEntries);
+    }
+    json_decref(jsonIndex);
+    return !root.empty();
+}
+
+void ScalaLibrary::saveIndex(const std::string &indexFile, const std::string &root, time_t rootModifiedTime,
+                             const std::vector<Entry> &entries) {
+    json_t *jsonIndex = json_object();
+    json_t *jsonScales = json_array();
+    for (auto entry = entries.begin(); entry != entries.end(); entry++) {
+        json_t *scale = json_object();
+        json_t *description = json_string(entry->description.c_str());
+        if (!description) { // not valid UTF-8
+            description = json_string("");
+        }
+        json_object_set_new(scale, "path", json_string(entry->path.c_str()));
+        json_object_set_new(scale, "modifiedTime", json_integer(entry->modifiedTime));
+        json_object_set_new(scale, "size", json_integer(entry->size));
+        json_object_set_new(scale, "description", description);
+        json_object_set_new(scale, "numNotes", json_integer(entry->numNotes));
+        json_object_set_new(scale, "period", json_real(entry->period));
+        json_array_append_new(jsonScales, scale);
+    }
+    json_object_set_new(jsonIndex, "root", json_string(root.c_str()));
+    json_object_set_new(jsonIndex, "rootModifiedTime", json_integer(rootModifiedTime));
+    json_object_set_new(jsonIndex, "scales", jsonScales);
+    // write a temporary file first, so that a crash or a full disk can't leave a truncated index behind
+    std::string tempFileName = indexFile + ".tmp";
+    FILE *file = fopen(tempFileName.c_str(), "w");
+    if (file) {
+        bool saved = json_dumpf(jsonIndex, file, JSON_INDENT(1)) == 0;
+        saved = fclose(file) == 0 and saved;
+        saved = saved and system::rename(tempFileName, indexFile);
+        if (!saved) {
+            remove(tempFileName.c_str());
+        }
+    }
+    json_decref(jsonIndex);
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+#define MAX_LIBRARY_DEPTH 8 // how deep to look into the folders under the library root
+
+/*
+ * An index of all scala files under a folder (the library root), so that large collections can be
+ * searched without touching the files. It is built by a background thread and kept in a JSON file under
+ * the user folder. The saved index is used as is: the folder is only scanned again when its modification
+ * time changes or the user asks for it, and then only the files that are new or modified are parsed. The
+ * last instance of the module calls stop(), the destructor leaves the thread alone.
+ */
+struct ScalaLibrary {
+
+    struct Entry {
+        std::string path;
+        time_t modifiedTime;
+        off_t size;
+        std::string name; // the file name
+        std::string description;
+        int numNotes; // 0 if the file can't be used
+        double period; // in cents
+        std::string searchText; // name and description in lower case
+    };
+
+    std::vector<Entry> entries; // sorted by name
+    std::string root;
+    time_t rootModifiedTime = 0; // of the root folder when it was last scanned
+    std::string indexFile;
+    bool indexLoaded = false;
+
+    // what the next scan should do
+    std::string defaultRoot; // used if no root has been chosen yet
+    std::string newRoot; // chosen by the user
+    bool scanRequested = false;
+    bool rescanRequested = false; // scan even if the root folder seems unchanged
+
+    bool scanning = false;
+    std::atomic<bool> stopRequested {false};
+    std::mutex mutex;
+    std::thread thread;
+
+    // Stop the thread, until the next update starts it again
+    void stop();
+
+    // Load the index and check the root folder for changes in the background. Scans defaultRoot if no root
+    // has been chosen yet.
+    void update(const std::string &indexFile, const std::string &defaultRoot);
+
+    // Scan the root folder again (in the background), also for changes deeper down that don't show in its
+    // modification time
+    void rescan(const std::string &indexFile);
+
+    // Index another folder (in the background)
+    void setRoot(const std::string &indexFile, const std::string &root);
+
+    std::string getRoot();
+
+    bool isScanning();
+
+    // The entries (up to maxResults) whose name or description contains all words of the query, ignoring
+    // case. Returns the total number of matches.
+    size_t search(const std::string &query, size_t maxResults, std::vector<Entry> &results);
+
+    // Called with the mutex held
+    void requestScan();
+
+    void run();
+    void scan(const std::string &root, std::vector<Entry> &entries, bool &changed);
+    void findFiles(const std::string &dir, int depth, std::vector<std::string> &files);
+    bool loadIndex(const std::string &indexFile, std::string &root, time_t &rootModifiedTime,
+                   std::vector<Entry> &entries);
+    void saveIndex(const std::string &indexFile, const std::string &root, time_t rootModifiedTime,
+                   const std::vector<Entry> &entries);
+};
+
+extern ScalaLibrary scalaLibrary;
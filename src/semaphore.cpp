@@ -0,0 +1,80 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#include "semaphore.hpp"
+#if defined(ARCH_WIN)
+#include <windows.h>
+#include <climits>
+#else
+#include <cerrno>
+#endif
+
+#if defined(ARCH_WIN)
+
+Semaphore::Semaphore() {
+    handle = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+}
+
+Semaphore::~Semaphore() {
+    CloseHandle(handle);
+}
+
+void Semaphore::post() {
+    ReleaseSemaphore(handle, 1, NULL);
+}
+
+void Semaphore::wait() {
+    WaitForSingleObject(handle, INFINITE);
+}
+
+#elif defined(ARCH_MAC)
+
+// unnamed POSIX semaphores aren't supported on macOS
+Semaphore::Semaphore() {
+    semaphore = dispatch_semaphore_create(0);
+}
+
+Semaphore::~Semaphore() {
+    dispatch_release(semaphore);
+}
+
+void Semaphore::post() {
+    dispatch_semaphore_signal(semaphore);
+}
+
+void Semaphore::wait() {
+    dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
+}
+
+#else
+
+Semaphore::Semaphore() {
+    sem_init(&semaphore, 0, 0);
+}
+
+Semaphore::~Semaphore() {
+    sem_destroy(&semaphore);
+}
+
+void Semaphore::post() {
+    sem_post(&semaphore);
+}
+
+void Semaphore::wait() {
+    // a signal may interrupt the wait
+    while (sem_wait(&semaphore) != 0 and errno == EINTR) {
+    }
+}
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#if defined(ARCH_MAC)
+#include <dispatch/dispatch.h>
+#elif !defined(ARCH_WIN)
+#include <semaphore.h>
+#endif
+
+/*
+ * A counting semaphore. Unlike notifying a condition variable, post() never takes a lock, so the audio
+ * thread can use it to wake up a background thread.
+ */
+struct Semaphore {
+
+#if defined(ARCH_WIN)
+    void *handle;
+#elif defined(ARCH_MAC)
+    dispatch_semaphore_t semaphore;
+#else
+    sem_t semaphore;
+#endif
+
+    Semaphore();
+    ~Semaphore();
+
+    void post();
+
+    // Wait until the count is positive, and decrement it
+    void wait();
+};
@@ -0,0 +1,163 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#include "plugin.hpp"
+#include "settings.hpp"
+#include "utils.hpp"
+#include <algorithm>
+
+
+Settings settings;
+
+void Settings::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopRequested = true;
+    }
+    wakeUp.notify_one();
+    // the thread writes the last changes before it stops
+    if (thread.joinable()) {
+        thread.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    stopRequested = false;
+}
+
+std::list<std::string> Settings::getHistory() {
+    std::lock_guard<std::mutex> lock(mutex);
+    reload();
+    return history;
+}
+
+void Settings::addToHistory(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    reload();
+
+    // delete item if it already exists
+    auto it = std::find(history.begin(), history.end(), path);
+    if (it != std::end(history)) {
+        history.erase(it);
+    }
+
+    if (history.size() == MAX_HISTORY_SIZE) {
+        history.pop_back();
+    }
+
+    // finally add the new entry at the head
+    history.push_front(path);
+
+    // postpone the write, so that a quick series of changes is written once
+    version++;
+    saveTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(SETTINGS_SAVE_DELAY);
+    if (!thread.joinable()) {
+        thread = std::thread(&Settings::run, this);
+    }
+    wakeUp.notify_one();
+}
+
+// Read the settings file, unless it's unchanged since it was last read or written
+void Settings::reload() {
+    if (!loaded) {
+        fileName = asset::user(GLOBAL_SETTINGS_FILENAME);
+        loaded = true;
+    } else if (version != savedVersion) {
+        // the changes that are yet to be written are more recent
+        return;
+    }
+    time_t fileModifiedTime;
+    off_t fileSize;
+    if (!getFileStamp(fileName.c_str(), fileModifiedTime, fileSize)
+            or (fileModifiedTime == modifiedTime and fileSize == size)) {
+        return;
+    }
+    modifiedTime = fileModifiedTime;
+    size = fileSize;
+
+    FILE *file = fopen(fileName.c_str(), "r");
+    if (!file) {
+        return;
+    }
+
+    json_error_t error;
+    json_t *root = json_loadf(file, 0, &error);
+    fclose(file);
+    if (!root) {
+        return;
+    }
+
+    json_t *jsonHistory = json_object_get(root, "history");
+    if (jsonHistory) {
+        history.clear();
+        size_t i;
+        json_t *val;
+        json_array_foreach(jsonHistory, i, val) {
+            if (json_string_value(val)) {
+                history.push_back(json_string_value(val));
+            }
+        }
+    }
+    json_decref(root);
+}
+
+void Settings::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wakeUp.wait(lock, [this] {
+            return stopRequested or version != savedVersion;
+        });
+        // wait for the changes to settle down (unless we have to stop), every change postpones the write
+        while (!stopRequested and version != savedVersion and std::chrono::steady_clock::now() < saveTime) {
+            wakeUp.wait_until(lock, saveTime);
+        }
+        if (version != savedVersion) {
+            unsigned savingVersion = version;
+            std::list<std::string> savingHistory = history;
+            lock.unlock();
+            bool saved = save(fileName, savingHistory);
+            lock.lock();
+            savedVersion = savingVersion;
+            // don't read back what was just written
+            if (saved) {
+                getFileStamp(fileName.c_str(), modifiedTime, size);
+            }
+        }
+        if (stopRequested) {
+            return;
+        }
+    }
+}
+
+// Write the settings to a temporary file first, which then replaces the settings file
+bool Settings::save(const std::string &fileName, const std::list<std::string> &history) {
+    json_t *root = json_object();
+    json_t *jsonHistory = json_array();
+    for (auto entry = history.begin(); entry != history.end(); entry++) {
+        json_array_append_new(jsonHistory, json_string((*entry).c_str()));
+    }
+    json_object_set_new(root, "history", jsonHistory);
+
+    std::string tempFileName = fileName + ".tmp";
+    FILE *file = fopen(tempFileName.c_str(), "w");
+    bool saved = false;
+    if (file) {
+        saved = json_dumpf(root, file, JSON_INDENT(3)) == 0;
+        saved = fclose(file) == 0 and saved;
+        saved = saved and system::rename(tempFileName, fileName);
+        if (!saved) {
+            remove(tempFileName.c_str());
+        }
+    }
+    json_decref(root);
+    return saved;
+}
@@ -0,0 +1,71 @@
+/**
+ * Copyright 2023 Hanna Koppelaar
+ *
+ * This file is part of the h4n4 collection of VCV modules. This collection is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with the software. If not,
+ * see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sys/types.h>
+
+#define GLOBAL_SETTINGS_FILENAME "H4N4.json"
+#define MAX_HISTORY_SIZE 11 // Note: the context menu will show MAX_HISTORY_SIZE - 1 entries
+#define SETTINGS_SAVE_DELAY 1000 // in ms, changes within this time get written at once
+
+/*
+ * The settings shared by all instances of the module (the scala files used last), kept in memory. The
+ * settings file is read when they're first needed, and only again when its modification time or size
+ * changes, e.g. because another instance of Rack wrote it. Changes are written by a background thread, once
+ * they've settled down, to a temporary file that then replaces the settings file, so that it never ends up
+ * half written. The last instance of the module calls stop(), the destructor leaves the thread alone.
+ */
+struct Settings {
+
+    std::list<std::string> history; // most recent first
+
+    // the settings file as last read or written
+    std::string fileName;
+    time_t modifiedTime = 0;
+    off_t size = 0;
+    bool loaded = false;
+
+    // changes yet to be written
+    unsigned version = 0;
+    unsigned savedVersion = 0;
+    std::chrono::steady_clock::time_point saveTime;
+
+    bool stopRequested = false;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::thread thread; // started on the first change
+
+    // Write any pending changes and stop the thread, until the next change starts it again
+    void stop();
+
+    // The scala files used last, most recent first
+    std::list<std::string> getHistory();
+
+    // Put a scala file at the head of the history
+    void addToHistory(const std::string &path);
+
+    // Called with the mutex held
+    void reload();
+
+    void run();
+    bool save(const std::string &fileName, const std::list<std::string> &history);
+};
+
+extern Settings settings;
@@ -40,3 +40,13 @@ std::string getBaseName(const char *fileName) {
     std::string fileNameStr = fileName;
     return fileNameStr.substr(fileNameStr.find_last_of("/\\") + 1);
 }
+
+bool getFileStamp(const char *fileName, time_t &modifiedTime, off_t &size) {
+    struct stat info;
+    if (stat(fileName, &info) != 0) {
+        return false;
+    }
+    modifiedTime = info.st_mtime;
+    size = info.st_size;
+    return true;
+}
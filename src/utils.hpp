@@ -21,3 +21,7 @@ bool exists(const char *fileName);
 std::string getParentDir(const char *fileName);
 
 std::string getBaseName(const char *fileName);
+
+// The modification time and size of a file, which tell whether it has changed since. Returns false if it
+// can't be accessed.
+bool getFileStamp(const char *fileName, time_t &modifiedTime, off_t &size);